@@ -1645,7 +1645,7 @@ extern void USB_EpnClearOutPacketReady(void);
 extern void USB_EpnOutEnableDoubleBuffer(void);
 #else
 #define USB_EpnOutEnableDoubleBuffer() \
-    USB_SET_BITS(EOUTCSRH, EOUTCSRH_DBIEN__ENABLED)
+    USB_SET_BITS(EOUTCSRH, EOUTCSRH_DBOEN__ENABLED)
 #endif
 
 /***************************************************************************//**
@@ -1656,7 +1656,7 @@ extern void USB_EpnOutEnableDoubleBuffer(void);
 extern void USB_EpnOutDisableDoubleBuffer(void);
 #else
 #define USB_EpnOutDisableDoubleBuffer() \
-    USB_CLEAR_BITS(EOUTCSRH, EOUTCSRH_DBIEN__ENABLED)
+    USB_CLEAR_BITS(EOUTCSRH, EOUTCSRH_DBOEN__ENABLED)
 #endif
 
 /***************************************************************************//**
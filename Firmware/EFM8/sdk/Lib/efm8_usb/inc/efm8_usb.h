@@ -1162,6 +1162,10 @@ typedef struct
 #if SLAB_USB_EP3OUT_USED
   USBD_Ep_TypeDef ep3out;
 #endif
+#if ((SLAB_USB_EP1IN_USED) && (SLAB_USB_EP1IN_DOUBLE_BUFFER))
+  uint8_t ep1inNext;      // Size of the packet queued behind ep1in, 0 = none
+  bool ep1inNextCb;       // Callback flag of the queued packet
+#endif
 #if ((SLAB_USB_EP3IN_USED) && (SLAB_USB_EP3IN_TRANSFER_TYPE == USB_EPTYPE_ISOC))
   uint16_t ep3inIsoIdx;
 #endif
@@ -1824,6 +1828,30 @@ USB_Status_TypeDef USBDCH9_SetupCmd(void);
 #define SLAB_USB_EP3OUT_TRANSFER_TYPE     USB_EPTYPE_INTR
 #endif
 
+#ifndef SLAB_USB_EP1IN_DOUBLE_BUFFER
+#define SLAB_USB_EP1IN_DOUBLE_BUFFER      0
+#endif
+
+#ifndef SLAB_USB_EP2OUT_DOUBLE_BUFFER
+#define SLAB_USB_EP2OUT_DOUBLE_BUFFER     0
+#endif
+
+#ifndef SLAB_USB_BULK_XDATA_FIFO
+#define SLAB_USB_BULK_XDATA_FIFO          0
+#endif
+
+#if (SLAB_USB_BULK_XDATA_FIFO && !(SLAB_USB_EP1IN_USED && SLAB_USB_EP2OUT_USED))
+#error "SLAB_USB_BULK_XDATA_FIFO requires EP1IN and EP2OUT."
+#endif
+
+// The fixed FIFO copies move 4 bytes per loop pass when every packet of
+// both bulk endpoints holds whole 4-byte USB-MIDI event packets.
+#ifndef SLAB_USB_BULK_FIFO_UNROLL
+#define SLAB_USB_BULK_FIFO_UNROLL         (SLAB_USB_BULK_XDATA_FIFO                        \
+                                           && ((SLAB_USB_EP1IN_MAX_PACKET_SIZE % 4) == 0)  \
+                                           && ((SLAB_USB_EP2OUT_MAX_PACKET_SIZE % 4) == 0))
+#endif
+
 #ifndef SLAB_USB_RESET_CB
 #define SLAB_USB_RESET_CB                 0
 #endif
@@ -1926,6 +1954,11 @@ void USBD_Disconnect(void);
  * @param epAddr
  *   The address of the endpoint to check.
  *
+ * @note
+ *   With SLAB_USB_EP1IN_DOUBLE_BUFFER, EP1IN is not busy while the last
+ *   packet of a transfer waits for the host and the second FIFO buffer is
+ *   free: USBD_Write() may queue one more packet.
+ *
  * @return
  *   True if endpoint is busy, false otherwise.
  ******************************************************************************/
@@ -1970,7 +2003,8 @@ int8_t USBD_Init(SI_VARIABLE_SEGMENT_POINTER(p, const USBD_Init_TypeDef, SI_SEG_
  *   Endpoint address.
  *
  * @param dat
- *   Pointer to transfer data buffer.
+ *   Pointer to transfer data buffer. With SLAB_USB_BULK_XDATA_FIFO, the
+ *   EP2OUT buffer must be in XDATA.
  *
  * @param byteCount
  *   Transfer length.
@@ -2077,6 +2111,7 @@ int8_t USBD_UnStallEp(uint8_t epAddr);
  *
  * @param dat
  *   Pointer to transfer data buffer. This buffer must be WORD (4 byte) aligned.
+ *   With SLAB_USB_BULK_XDATA_FIFO, the EP1IN buffer must be in XDATA.
  *
  * @param byteCount
  *   Transfer length.
@@ -2313,6 +2348,10 @@ uint16_t USBD_XferCompleteCb(uint8_t epAddr, \
 // -------------------- FIFO Access Functions  ---------------------------------
 void USB_ReadFIFO(uint8_t fifoNum, uint8_t numBytes, SI_VARIABLE_SEGMENT_POINTER(dat, uint8_t, SI_SEG_GENERIC));
 void USB_WriteFIFO(uint8_t fifoNum, uint8_t numBytes, SI_VARIABLE_SEGMENT_POINTER(dat, uint8_t, SI_SEG_GENERIC), bool txPacket);
+#if SLAB_USB_BULK_XDATA_FIFO
+void USB_ReadFIFO_Ep2Out(uint8_t numBytes, SI_VARIABLE_SEGMENT_POINTER(dat, uint8_t, SI_SEG_XDATA));
+void USB_WriteFIFO_Ep1In(uint8_t numBytes, SI_VARIABLE_SEGMENT_POINTER(dat, uint8_t, SI_SEG_XDATA));
+#endif
 /// @endcond DO_NOT_INCLUDE_WITH_DOXYGEN
 
 // -------------------- Include Files ------------------------------------------
@@ -42,6 +42,30 @@ SI_SEGMENT_VARIABLE(myUsbDevice, USBD_Device_TypeDef, MEM_MODEL_SEG);
 // Function in efm8_usbdint.c to force load the module for libraries
 extern void forceModuleLoad_usbint(void);
 
+#if ((SLAB_USB_EP1IN_USED) && (SLAB_USB_EP1IN_DOUBLE_BUFFER))
+/***************************************************************************//**
+ * @brief       Checks if one more packet can be queued on EP1IN
+ * @details     The current transfer must be on its last packet (already in
+ *              the FIFO), nothing queued yet, and the hardware must have a
+ *              free FIFO buffer (INPRDY is cleared at once on load when the
+ *              other buffer is empty).
+ * @note        Must be called with USB interrupts disabled.
+ ******************************************************************************/
+static bool Ep1InCanQueue(void)
+{
+  if ((myUsbDevice.ep1in.state != D_EP_TRANSMITTING)
+      || (myUsbDevice.ep1in.remaining > SLAB_USB_EP1IN_MAX_PACKET_SIZE)
+      || (myUsbDevice.ep1inNext != 0))
+  {
+    return false;
+  }
+
+  USB_SetIndex(1);
+  USB_READ_BYTE(EINCSRL);
+  return (bool)!(USB0DAT & EINCSRL_INPRDY__SET);
+}
+#endif
+
 // -----------------------------------------------------------------------------
 // USB API Functions
 
@@ -91,6 +115,9 @@ int8_t USBD_AbortTransfer(uint8_t epAddr)
   #if SLAB_USB_EP1IN_USED
         case EP1IN:
           USB_AbortInEp(1);
+    #if SLAB_USB_EP1IN_DOUBLE_BUFFER
+          myUsbDevice.ep1inNext = 0;
+    #endif
           break;
   #endif
   #if SLAB_USB_EP2IN_USED
@@ -166,6 +193,22 @@ bool USBD_EpIsBusy(uint8_t epAddr)
     return false;
   }
 
+#if ((SLAB_USB_EP1IN_USED) && (SLAB_USB_EP1IN_DOUBLE_BUFFER))
+  if (epAddr == EP1IN)
+  {
+    bool usbIntsEnabled;
+    bool canQueue;
+
+    USB_SaveSfrPage();
+    DISABLE_USB_INTS;
+    canQueue = Ep1InCanQueue();
+    ENABLE_USB_INTS;
+    USB_RestoreSfrPage();
+
+    return !canQueue;
+  }
+#endif
+
   return true;
 }
 
@@ -670,6 +713,34 @@ int8_t USBD_Write(uint8_t epAddr,
 
   ep = GetEp(epAddr);
 
+#if ((SLAB_USB_EP1IN_USED) && (SLAB_USB_EP1IN_DOUBLE_BUFFER))
+  // A single packet may be queued in the second FIFO buffer behind the last
+  // packet of the current transfer. It is loaded now, so the caller may
+  // reuse the buffer. handleUsbIn1Int() makes it the current transfer.
+  if ((epAddr == EP1IN) && (ep->state == D_EP_TRANSMITTING)
+      && (byteCount > 0) && (byteCount <= SLAB_USB_EP1IN_MAX_PACKET_SIZE))
+  {
+    int8_t retVal = USB_STATUS_EP_BUSY;
+
+    DISABLE_USB_INTS;
+    if (Ep1InCanQueue())
+    {
+#if SLAB_USB_BULK_XDATA_FIFO
+      USB_WriteFIFO_Ep1In((uint8_t)byteCount, (SI_VARIABLE_SEGMENT_POINTER(, uint8_t, SI_SEG_XDATA))dat);
+#else
+      USB_WriteFIFO(1, (uint8_t)byteCount, dat, true);
+#endif
+      myUsbDevice.ep1inNext = (uint8_t)byteCount;
+      myUsbDevice.ep1inNextCb = callback;
+      retVal = USB_STATUS_OK;
+    }
+    ENABLE_USB_INTS;
+    USB_RestoreSfrPage();
+
+    return retVal;
+  }
+#endif
+
   // If the endpoint is not idle, we cannot start a new transfer.
   // Return the appropriate error code.
   if (ep->state != D_EP_IDLE)
@@ -703,10 +774,15 @@ int8_t USBD_Write(uint8_t epAddr,
     // between the call to USBD_Write() and the first packet being sent.
 #if SLAB_USB_EP1IN_USED
     case (EP1IN):
+#if SLAB_USB_BULK_XDATA_FIFO
+      USB_WriteFIFO_Ep1In((byteCount > SLAB_USB_EP1IN_MAX_PACKET_SIZE) ? SLAB_USB_EP1IN_MAX_PACKET_SIZE : byteCount,
+                          (SI_VARIABLE_SEGMENT_POINTER(, uint8_t, SI_SEG_XDATA))dat);
+#else
       USB_WriteFIFO(1,
                     (byteCount > SLAB_USB_EP1IN_MAX_PACKET_SIZE) ? SLAB_USB_EP1IN_MAX_PACKET_SIZE : byteCount,
                     myUsbDevice.ep1in.buf,
                     true);
+#endif
       break;
 #endif // SLAB_USB_EP1IN_USED
 #if SLAB_USB_EP2IN_USED
@@ -789,6 +789,9 @@ static void USBD_ActivateAllEps(bool forceIdle)
   {
 #if SLAB_USB_EP1IN_USED
     myUsbDevice.ep1in.state = D_EP_IDLE;
+#if SLAB_USB_EP1IN_DOUBLE_BUFFER
+    myUsbDevice.ep1inNext = 0;
+#endif
 #endif
 #if SLAB_USB_EP2IN_USED
     myUsbDevice.ep2in.state = D_EP_IDLE;
@@ -813,6 +816,13 @@ static void USBD_ActivateAllEps(bool forceIdle)
                  1,                                                   // inDir
                  SLAB_USB_EP1OUT_USED,                                // splitMode
                  0);                                                  // isoMod
+  // USB_ActivateEp() turns double buffering on whenever the packet fits
+  // half of the FIFO; follow the configuration instead.
+#if SLAB_USB_EP1IN_DOUBLE_BUFFER
+  USB_EpnInEnableDoubleBuffer();
+#else
+  USB_EpnInDisableDoubleBuffer();
+#endif
 #endif // SLAB_USB_EP1IN_USED
 #if SLAB_USB_EP2IN_USED
   USB_ActivateEp(2,                                                   // ep
@@ -841,6 +851,11 @@ static void USBD_ActivateAllEps(bool forceIdle)
                  0,                                                   // inDir
                  SLAB_USB_EP2IN_USED,                                 // splitMode
                  0);                                                  // isoMod
+#if SLAB_USB_EP2OUT_DOUBLE_BUFFER
+  USB_EpnOutEnableDoubleBuffer();
+#else
+  USB_EpnOutDisableDoubleBuffer();
+#endif
 #endif // SLAB_USB_EP2OUT_USED
 #if SLAB_USB_EP3OUT_USED
   USB_ActivateEp(3,                                                   // ep
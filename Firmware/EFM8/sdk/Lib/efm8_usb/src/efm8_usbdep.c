@@ -126,6 +126,7 @@ void USB_WriteFIFOIso(uint8_t fifoNum, uint16_t numBytes, SI_VARIABLE_SEGMENT_PO
 void handleUsbIn1Int(void)
 {
   uint8_t xferred;
+  uint16_t remaining;
   bool callback;
 
   USB_SetIndex(1);
@@ -142,17 +143,35 @@ void handleUsbIn1Int(void)
     myUsbDevice.ep1in.buf += xferred;
 
     callback = myUsbDevice.ep1in.misc.bits.callback;
+    remaining = myUsbDevice.ep1in.remaining;
 
     // Load more data
     if (myUsbDevice.ep1in.remaining > 0)
     {
+#if SLAB_USB_BULK_XDATA_FIFO
+      USB_WriteFIFO_Ep1In((myUsbDevice.ep1in.remaining > SLAB_USB_EP1IN_MAX_PACKET_SIZE)
+                            ? SLAB_USB_EP1IN_MAX_PACKET_SIZE
+                            : myUsbDevice.ep1in.remaining,
+                          (SI_VARIABLE_SEGMENT_POINTER(, uint8_t, SI_SEG_XDATA))myUsbDevice.ep1in.buf);
+#else
       USB_WriteFIFO(1,
                     (myUsbDevice.ep1in.remaining > SLAB_USB_EP1IN_MAX_PACKET_SIZE)
                       ? SLAB_USB_EP1IN_MAX_PACKET_SIZE
                       : myUsbDevice.ep1in.remaining,
                     myUsbDevice.ep1in.buf,
                     true);
+#endif
+    }
+#if SLAB_USB_EP1IN_DOUBLE_BUFFER
+    // One interrupt per packet sent: the packet queued in the other FIFO
+    // buffer by USBD_Write() is the current transfer now, it is loaded.
+    else if (myUsbDevice.ep1inNext > 0)
+    {
+      myUsbDevice.ep1in.remaining = myUsbDevice.ep1inNext;
+      myUsbDevice.ep1in.misc.bits.callback = myUsbDevice.ep1inNextCb;
+      myUsbDevice.ep1inNext = 0;
     }
+#endif
     else
     {
       myUsbDevice.ep1in.misc.bits.callback = false;
@@ -161,7 +180,7 @@ void handleUsbIn1Int(void)
 
     if (callback == true)
     {
-      USBD_XferCompleteCb(EP1IN, USB_STATUS_OK, xferred, myUsbDevice.ep1in.remaining);
+      USBD_XferCompleteCb(EP1IN, USB_STATUS_OK, xferred, remaining);
     }
 
   }
@@ -415,7 +434,11 @@ void handleUsbOut2Int(void)
     }
     else
     {
+#if SLAB_USB_BULK_XDATA_FIFO
+      USB_ReadFIFO_Ep2Out(count, (SI_VARIABLE_SEGMENT_POINTER(, uint8_t, SI_SEG_XDATA))myUsbDevice.ep2out.buf);
+#else
       USB_ReadFIFO(2, count, myUsbDevice.ep2out.buf);
+#endif
 
       myUsbDevice.ep2out.misc.bits.outPacketPending = false;
       myUsbDevice.ep2out.remaining -= count;
@@ -808,6 +831,99 @@ void USB_WriteFIFO(uint8_t fifoNum, uint8_t numBytes, SI_VARIABLE_SEGMENT_POINTE
   }
 }
 
+#if SLAB_USB_BULK_XDATA_FIFO
+/***************************************************************************//**
+ * @brief       Reads a packet from the Endpoint 2 OUT FIFO to XRAM
+ * @details     Same as USB_ReadFIFO(2, numBytes, dat), but the FIFO number
+ *              is a constant and the buffer is known to be in XDATA, so no
+ *              generic pointer is decoded. With SLAB_USB_BULK_FIFO_UNROLL,
+ *              multiples of 4 bytes are read 4 bytes per loop pass.
+ * @param       numBytes
+ *              Number of bytes to read from the FIFO
+ * @param       dat
+ *              Pointer to XDATA buffer to hold data read from the FIFO
+ ******************************************************************************/
+void USB_ReadFIFO_Ep2Out(uint8_t numBytes, SI_VARIABLE_SEGMENT_POINTER(dat, uint8_t, SI_SEG_XDATA))
+{
+  if (numBytes > 0)
+  {
+    USB_EnableReadFIFO(2);
+#if SLAB_USB_BULK_FIFO_UNROLL
+    // One event per pass, the last event ends with the non-autoread byte
+    if ((numBytes & 3) == 0)
+    {
+      numBytes >>= 2;
+      while (--numBytes)
+      {
+        USB_GetFIFOByte(dat);
+        USB_GetFIFOByte(dat + 1);
+        USB_GetFIFOByte(dat + 2);
+        USB_GetFIFOByte(dat + 3);
+        dat += 4;
+      }
+      USB_GetFIFOByte(dat);
+      USB_GetFIFOByte(dat + 1);
+      USB_GetFIFOByte(dat + 2);
+      USB_GetLastFIFOByte(dat + 3, 2);
+      USB_DisableReadFIFO(2);
+      return;
+    }
+#endif
+    while (--numBytes)
+    {
+      USB_GetFIFOByte(dat);
+      dat++;
+    }
+    USB_GetLastFIFOByte(dat, 2);
+    USB_DisableReadFIFO(2);
+  }
+}
+
+/***************************************************************************//**
+ * @brief       Writes a packet held in XRAM to the Endpoint 1 IN FIFO
+ * @details     Same as USB_WriteFIFO(1, numBytes, dat, true), but the FIFO
+ *              number is a constant and the buffer is known to be in XDATA,
+ *              so no generic pointer is decoded. With
+ *              SLAB_USB_BULK_FIFO_UNROLL, multiples of 4 bytes are written
+ *              4 bytes per loop pass.
+ * @param       numBytes
+ *              Number of bytes to write to the FIFO
+ * @param       dat
+ *              Pointer to XDATA buffer holding data to write to the FIFO
+ ******************************************************************************/
+void USB_WriteFIFO_Ep1In(uint8_t numBytes, SI_VARIABLE_SEGMENT_POINTER(dat, uint8_t, SI_SEG_XDATA))
+{
+  USB_EnableWriteFIFO(1);
+#if SLAB_USB_BULK_FIFO_UNROLL
+  // One event per pass
+  if ((numBytes & 3) == 0)
+  {
+    numBytes >>= 2;
+    while (numBytes--)
+    {
+      USB_SetFIFOByte(dat[0]);
+      USB_SetFIFOByte(dat[1]);
+      USB_SetFIFOByte(dat[2]);
+      USB_SetFIFOByte(dat[3]);
+      dat += 4;
+    }
+  }
+  else
+#endif
+  {
+    while (numBytes--)
+    {
+      USB_SetFIFOByte(*dat);
+      dat++;
+    }
+  }
+  USB_DisableWriteFIFO(1);
+
+  USB_SetIndex(1);
+  USB_EpnSetInPacketReady();
+}
+#endif  // SLAB_USB_BULK_XDATA_FIFO
+
 // -----------------------------------------------------------------------------
 // Memory-Specific FIFO Access Functions
 //
@@ -62,7 +62,7 @@ SI_SEGMENT_VARIABLE
 	//--- Configuration Descriptor header, p.37
 	USB_CONFIG_DESCSIZE,               // bLength, 9 bytes
 	USB_CONFIG_DESCRIPTOR,             // bDescriptorType, 2
-	101,                               // wTotalLength(LSB), 101 bytes
+	150 + 16 * MIDI_SOFT_PORTS,        // wTotalLength(LSB), 150 + 16*n
 	0x00,                              // wTotalLength(MSB)
 	0x02,                              // bNumInterfaces
 	0x01,                              // bConfigurationValue
@@ -103,8 +103,13 @@ SI_SEGMENT_VARIABLE
 	0,                                 // bInterfaceProtocol, unused
 	0,                                 // iInterface, unused
 
-	// EMB:  IN Jack #1 <-----> EXT: OUT Jack #4
+	// EMB:  IN Jack #1 <-----> EXT: OUT Jack #4    (cable 0, MIDI port)
 	// EMB: OUT Jack #3 <-----> EXT:  IN Jack #2
+	// EMB:  IN Jack #5 <-----> EMB: OUT Jack #6    (cable 1, loopback)
+	// EMB:  IN Jack #7 <-----> EXT: OUT Jack #10   (cable 2, MIDI port 1)
+	// EMB: OUT Jack #9 <-----> EXT:  IN Jack #8
+	// EMB: OUT Jack #12, #14, #16 <-- EXT: IN Jack #11, #13, #15
+	//                                  (cable 3..5, MIDI_SOFT_PORTS, IN only)
 
 	//--- Class-Specific MS Interface Header Descriptor, p.40
 	USB_MIDI_INTERFACE_DESCSIZE,       // bLength, 7 bytes
@@ -112,10 +117,10 @@ SI_SEGMENT_VARIABLE
 	MIDI_CS_IF_HEADER,                 // bDescriptorSubtype, 0x01
 	0x00,                              // bcdADC(LSB)
 	0x01,                              // bcdADC(MSB), 0x0100 (version)
-	0x41,                              // wTotalLength(LSB), 65 bytes
+	0x72 + 16 * MIDI_SOFT_PORTS,       // wTotalLength(LSB), 114 + 16*n
 	0x00,                              // wTotalLength(MSB)
 
-	//--- MIDI IN JACK EMB(it connects to the USB OUT Endpoint), p.40
+	//--- MIDI IN JACK EMB(it connects to the USB OUT Endpoint), p.40, cable 0
 	USB_IN_JACK_DESCSIZE,              // bLength, 6 bytes
 	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
 	MIDI_CS_IF_IN_JACK,                // bDescriptorSubtype, 0x02
@@ -151,8 +156,119 @@ SI_SEGMENT_VARIABLE
 	1,                                 // baSourcePin
 	0,                                 // iJack, unused
 
-	//  IN Jack Emb #1 <=====> OUT EP 0x02
-	// OUT Jack Emb #3 <=====>  IN EP 0x81
+	//--- MIDI IN JACK EMB, cable 1 (loopback, see aCableRoute[])
+	USB_IN_JACK_DESCSIZE,              // bLength, 6 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_IN_JACK,                // bDescriptorSubtype, 0x02
+	MIDI_JACK_TYPE_EMB,                // bJackType, 0x01 (embedded)
+	5,                                 // bJackID, #5
+	0,                                 // Jack string descriptor, unused
+	//--- MIDI OUT JACK EMB, cable 1 (loopback)
+	USB_OUT_JACK_DESCSIZE,             // bLength, 9 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_OUT_JACK,               // bDescriptorSubtype, 0x03
+	MIDI_JACK_TYPE_EMB,                // bJackType, 0x01
+	6,                                 // bJackID
+	1,                                 // bNrInputPins
+	5,                                 // baSourceID, this <=> Jack #5
+	1,                                 // baSourcePin
+	0,                                 // iJack, unused
+
+	//--- MIDI IN JACK EMB, cable 2 (MIDI port 1)
+	USB_IN_JACK_DESCSIZE,              // bLength, 6 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_IN_JACK,                // bDescriptorSubtype, 0x02
+	MIDI_JACK_TYPE_EMB,                // bJackType, 0x01 (embedded)
+	7,                                 // bJackID, #7
+	0,                                 // Jack string descriptor, unused
+	//--- MIDI IN JACK EXT, cable 2
+	USB_IN_JACK_DESCSIZE,              // bLength, 6 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_IN_JACK,                // bDescriptorSubtype, 0x02
+	MIDI_JACK_TYPE_EXT,                // bJackType, 0x02 (external)
+	8,                                 // bJackID, #8
+	0,                                 // Jack string descriptor, unused
+	//--- MIDI OUT JACK EMB, cable 2
+	USB_OUT_JACK_DESCSIZE,             // bLength, 9 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_OUT_JACK,               // bDescriptorSubtype, 0x03
+	MIDI_JACK_TYPE_EMB,                // bJackType, 0x01
+	9,                                 // bJackID
+	1,                                 // bNrInputPins
+	8,                                 // baSourceID, this <=> Jack #8
+	1,                                 // baSourcePin
+	0,                                 // iJack, unused
+	//--- MIDI OUT JACK EXT, cable 2
+	USB_OUT_JACK_DESCSIZE,             // bLength, 9 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_OUT_JACK,               // bDescriptorSubtype, 0x03
+	MIDI_JACK_TYPE_EXT,                // bJackType, 0x02
+	10,                                // bJackID
+	1,                                 // bNrInputPins
+	7,                                 // baSourceID, this <=> Jack #7
+	1,                                 // baSourcePin
+	0,                                 // iJack, unused
+
+#if MIDI_SOFT_PORTS > 0
+	//--- MIDI IN JACK EXT, cable 3 (software port CEX0, IN only)
+	USB_IN_JACK_DESCSIZE,              // bLength, 6 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_IN_JACK,                // bDescriptorSubtype, 0x02
+	MIDI_JACK_TYPE_EXT,                // bJackType, 0x02 (external)
+	11,                              // bJackID, #11
+	0,                                 // Jack string descriptor, unused
+	//--- MIDI OUT JACK EMB, cable 3
+	USB_OUT_JACK_DESCSIZE,             // bLength, 9 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_OUT_JACK,               // bDescriptorSubtype, 0x03
+	MIDI_JACK_TYPE_EMB,                // bJackType, 0x01
+	12,                              // bJackID
+	1,                                 // bNrInputPins
+	11,                              // baSourceID, this <=> Jack #11
+	1,                                 // baSourcePin
+	0,                                 // iJack, unused
+#endif
+#if MIDI_SOFT_PORTS > 1
+	//--- MIDI IN JACK EXT, cable 4 (software port CEX1, IN only)
+	USB_IN_JACK_DESCSIZE,              // bLength, 6 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_IN_JACK,                // bDescriptorSubtype, 0x02
+	MIDI_JACK_TYPE_EXT,                // bJackType, 0x02 (external)
+	13,                              // bJackID, #13
+	0,                                 // Jack string descriptor, unused
+	//--- MIDI OUT JACK EMB, cable 4
+	USB_OUT_JACK_DESCSIZE,             // bLength, 9 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_OUT_JACK,               // bDescriptorSubtype, 0x03
+	MIDI_JACK_TYPE_EMB,                // bJackType, 0x01
+	14,                              // bJackID
+	1,                                 // bNrInputPins
+	13,                              // baSourceID, this <=> Jack #13
+	1,                                 // baSourcePin
+	0,                                 // iJack, unused
+#endif
+#if MIDI_SOFT_PORTS > 2
+	//--- MIDI IN JACK EXT, cable 5 (software port CEX2, IN only)
+	USB_IN_JACK_DESCSIZE,              // bLength, 6 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_IN_JACK,                // bDescriptorSubtype, 0x02
+	MIDI_JACK_TYPE_EXT,                // bJackType, 0x02 (external)
+	15,                              // bJackID, #15
+	0,                                 // Jack string descriptor, unused
+	//--- MIDI OUT JACK EMB, cable 5
+	USB_OUT_JACK_DESCSIZE,             // bLength, 9 bytes
+	USB_CS_INTERFACE_DESCRIPTOR,       // bDescriptorType, 0x24
+	MIDI_CS_IF_OUT_JACK,               // bDescriptorSubtype, 0x03
+	MIDI_JACK_TYPE_EMB,                // bJackType, 0x01
+	16,                              // bJackID
+	1,                                 // bNrInputPins
+	15,                              // baSourceID, this <=> Jack #15
+	1,                                 // baSourcePin
+	0,                                 // iJack, unused
+#endif
+
+	//  IN Jack Emb #1, #5, #7 <=====> OUT EP 0x02 (cable 0, 1, 2)
+	// OUT Jack Emb #3, #6, #9 <=====>  IN EP 0x81 (cable 0, 1, 2, [3..5])
 
 	//--- Standard BULK IN Endpoint Descriptor
 	USB_AUDIO_EP_DESCSIZE,             // bLength, 9 bytes
@@ -160,16 +276,27 @@ SI_SEGMENT_VARIABLE
 	USB_EP_DIR_IN | 0x01,              // bEndpointAddress, IN EP #1 (0x81)
 	USB_EPTYPE_BULK,                   // bmAttributes, 0x02 (bulk)
 	SLAB_USB_EP1IN_MAX_PACKET_SIZE,    // wMaxPacketSize(LSB), 64
-	0,                                 // wMaxPacketSize(LSB), 0
+	0,                                 // wMaxPacketSize(MSB), 0
 	0,                                 // bInterval, unused
 	0,                                 // bRefresh, unused
 	0,                                 // bSynchAddress, unused
 	//--- Class-specific MIDI Stream BULK OUT Endpoint Descriptor
-	USB_MIDI_CS_EP_DESCSIZE,           // bLength, 5 bytes
+	USB_MIDI_CS_EP_DESCSIZE + 2 + MIDI_SOFT_PORTS, // bLength, 7 + n
 	USB_MIDI_CS_EP_DESCRIPTOR,         // bDescriptorType, 0x25
 	USB_MIDI_CS_EP_MS_GENERAL,         // bDescriptorSubtype, 0x01
-	1,                                 // bNumEmbMIDIJack
+	MIDI_CABLES_IN,                    // bNumEmbMIDIJack
 	3,                                 // baAssocJackID, OUT Jack Emb #3
+	6,                                 // baAssocJackID, OUT Jack Emb #6
+	9,                                 // baAssocJackID, OUT Jack Emb #9
+#if MIDI_SOFT_PORTS > 0
+	12,                                // baAssocJackID, OUT Jack Emb #12
+#endif
+#if MIDI_SOFT_PORTS > 1
+	14,                                // baAssocJackID, OUT Jack Emb #14
+#endif
+#if MIDI_SOFT_PORTS > 2
+	16,                                // baAssocJackID, OUT Jack Emb #16
+#endif
 
 	//--- Standard BULK OUT Endpoint Descriptor
 	USB_AUDIO_EP_DESCSIZE,             // bLength, 9 bytes
@@ -177,16 +304,18 @@ SI_SEGMENT_VARIABLE
 	USB_EP_DIR_OUT | 0x02,             // bEndpointAddress, OUT EP #2 (0x02)
 	USB_EPTYPE_BULK,                   // bmAttributes, 0x02 (bulk)
 	SLAB_USB_EP2OUT_MAX_PACKET_SIZE,   // wMaxPacketSize(LSB), 64
-	0,                                 // wMaxPacketSize(LSB), 0
+	0,                                 // wMaxPacketSize(MSB), 0
 	0,                                 // bInterval, unused
 	0,                                 // bRefresh, unused
 	0,                                 // bSynchAddress, unused
 	//--- Class-specific MIDI Stream BULK IN Endpoint Descriptor
-	USB_MIDI_CS_EP_DESCSIZE,           // bLength, 5 bytes
+	USB_MIDI_CS_EP_DESCSIZE + 2,       // bLength, 7 bytes
 	USB_MIDI_CS_EP_DESCRIPTOR,         // bDescriptorType, 0x25
 	USB_MIDI_CS_EP_MS_GENERAL,         // bDescriptorSubtype, 0x01
-	1,                                 // bNumEmbMIDIJack
-	1                                  // baAssocJackID, IN Jack Emb #1
+	MIDI_CABLES,                       // bNumEmbMIDIJack
+	1,                                 // baAssocJackID, IN Jack Emb #1
+	5,                                 // baAssocJackID, IN Jack Emb #5
+	7                                  // baAssocJackID, IN Jack Emb #7
 };
 
 //---------------------------------------------------------------------------//
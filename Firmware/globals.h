@@ -4,6 +4,8 @@
 // Author:  Maximov K.M. (c) https://makbit.com                              //
 // Date:    November 2022, September 2021, May-August 2020                   //
 //---------------------------------------------------------------------------//
+#ifndef GLOBALS_H
+#define GLOBALS_H
 #include <stdint.h>
 #include <stdbool.h>
 #include <SI_EFM8UB2_Defs.h>
@@ -11,15 +13,315 @@
 
 #define LED_IN          P1_B1
 #define LED_OUT         P1_B0
+// The 0/1 options below may also be given on the compiler command line.
 
 #define MIDI_BUF_SIZE   (SLAB_USB_EP1IN_MAX_PACKET_SIZE)
+// Zero-copy OUT: events are read one by one right from the EP2OUT FIFO      //
+// and the packet is released (OPRDY cleared) only when it is drained, so    //
+// the 64-byte copy in aUsbBuffer[] is not needed.                           //
+#ifndef MIDI_ZERO_COPY
+#define MIDI_ZERO_COPY  0                   // 1 = EP2OUT FIFO is OUT buffer
+#endif
+#if MIDI_ZERO_COPY
+#define USB_BUF_SIZE    4                   // One event staged from FIFO
+#else
 #define USB_BUF_SIZE    (SLAB_USB_EP2OUT_MAX_PACKET_SIZE)
+#endif
 
+//---------------------------------------------------------------------------//
+// Raw MIDI IN rings, one per port (producer: UART ISRs, PCA0_ISR; consumer: //
+// parser in the main loop). An entry is the received byte and the low byte  //
+// of nSystemTick, the ISR does nothing else. 32 entries hold 10ms of MIDI   //
+// at full rate, the main loop takes them much more often.                   //
+//---------------------------------------------------------------------------//
+#define MIDI_RAW_SIZE   32                  // Entries per port (2^n)
+#define MIDI_RAW_MASK   (MIDI_RAW_SIZE-1)
+
+//---------------------------------------------------------------------------//
+// MIDI->USB event ring (producer: parser, consumer: IN packet builder).     //
+// Each slot holds one 32-bit USB-MIDI Event Packet. Head and tail are free  //
+// running counters, only the owner writes its own index.                    //
+// The ring is the backlog for host stalls, EP1IN still gets one packet per  //
+// transfer. Worst input is 1 event per byte (Running Status with 1 data     //
+// byte): 3125 events/s per port, 157 events per port in a 50ms host stall.  //
+// 512 slots (2KB XRAM) hold a 50ms stall of up to 3 busy ports, 256 slots   //
+// of one (80ms), 128 slots 40ms of one port. MIDI_RING_SIZE is the largest  //
+// of them that fits into the XRAM the options leave (see XRAM budget below) //
+// unless it is set with -D. Tools/test/size_test stalls the host for 50ms.  //
+// The indices are 16-bit; both sides run in the main loop, no torn read.    //
+//---------------------------------------------------------------------------//
+#define MIDI_EVENT_SIZE (sizeof(uint32_t))
+#define MIDI_RING_MASK  (MIDI_RING_SIZE-1)  // MIDI_RING_SIZE: see XRAM budget
+typedef uint16_t MIDI_RING_INDEX;           // Free running ring index
+// System Real-Time queue, same scheme, entry is cable/CIN and RT byte. It   //
+// is drained ahead of the ring, so it must fit in one IN packet with room.  //
+#define MIDI_RTQ_SIZE   8                   // Number of RT entries (2^n)
+#define MIDI_RTQ_MASK   (MIDI_RTQ_SIZE-1)
+
+//---------------------------------------------------------------------------//
+// EP1IN flush policy: events arriving within one USB frame (1ms SOF) are    //
+// sent together in one packet. The packet leaves earlier when it is full,   //
+// or when a Note-On/Real-Time byte arrives and nothing was sent this frame. //
+//---------------------------------------------------------------------------//
+#ifndef MIDI_FLUSH_FRAMES
+#define MIDI_FLUSH_FRAMES 1                 // Latency ceiling, USB frames
+#endif
+#ifndef MIDI_FLUSH_URGENT
+#define MIDI_FLUSH_URGENT 1                 // Send Note-On at once if idle
+#endif
+
+//---------------------------------------------------------------------------//
+// USB->MIDI scheduler: whole messages wait in lanes by class, one set per   //
+// port. The UART ISR sends the next one from the first non-empty lane, each //
+// lane stays in order. A SysEx is never split by non-RT bytes (MIDI 1.0,    //
+// p.34). When a lane is full, the rest of the OUT packet waits and EP2OUT   //
+// stays NAKed.                                                              //
+//---------------------------------------------------------------------------//
+#define MIDI_LANE_NOTE  0                   // Note Off/On (highest priority)
+#define MIDI_LANE_VOICE 1                   // Other Channel Voice, Sys Common
+#define MIDI_LANE_SYSEX 2                   // SysEx, single bytes (CIN 0xF)
+#define MIDI_LANES      3
+#define MIDI_LANE_SIZE  32                  // Messages per lane (2^n)
+#define MIDI_LANE_MASK  (MIDI_LANE_SIZE-1)
+#define MIDI_TX_LEN     0x03                // Slot info: MIDI bytes (1..3)
+#define MIDI_TX_MORE    0x80                // Slot info: SysEx goes on
+#define MIDI_TX_SYSEX_HOLD 20               // Open SysEx keeps the wire, ms
+// Coalescing (opt-in): a new Pitch Bend, Channel/Poly Pressure or Control   //
+// Change replaces a value of the same channel/controller still waiting in   //
+// the Voice lane. Each controller then holds at most one slot, so its value //
+// is never older than one Voice lane drain: 32 x 3 bytes x 0.32ms = 31ms,   //
+// plus the Note lane traffic sent first. Notes and SysEx are never merged,  //
+// nor switches like Sustain: a press and release must both go out.          //
+#ifndef MIDI_TX_COALESCE
+#define MIDI_TX_COALESCE 0                  // 1 = latest controller value wins
+#endif
+#define MIDI_COAL_SIZE  64                  // CC hash table entries (2^n)
+#define MIDI_COAL_MASK  (MIDI_COAL_SIZE-1)
+// Real-Time bytes (F8-FF) use their own lane, the UART ISR sends them first //
+// between any two bytes of the lanes (MIDI 1.0 allows it, p.30).            //
+#define UART_RT_SIZE    16                  // RT lane size, bytes (2^n)
+#define UART_RT_MASK    (UART_RT_SIZE-1)
+#ifndef MIDI_RT_JITTER
+#define MIDI_RT_JITTER  0                   // 1 = keep RT delay histogram
+#endif
+#define MIDI_RT_BINS    8                   // Histogram bins, 80us each; the
+                                            // last one: that long or longer
+
+//---------------------------------------------------------------------------//
+// USB->MIDI running status: a channel status byte equal to the last one is  //
+// not sent again. It is resent after System Common/SysEx, and at least once //
+// per MIDI_RS_REFRESH ms so a receiver plugged in later can lock on. It is  //
+// applied by the scheduler, in the order bytes really go out.               //
+//---------------------------------------------------------------------------//
+#ifndef MIDI_RUNNING_STATUS
+#define MIDI_RUNNING_STATUS 1               // 0 = always send status byte
+#endif
+#ifndef MIDI_RS_REFRESH
+#define MIDI_RS_REFRESH     250             // Status refresh interval, ms
+#endif
+
+//---------------------------------------------------------------------------//
+// Routing: each USB-MIDI cable number (0-15) maps to a MIDI OUT port number //
+// (0..MIDI_PORTS-1) or to a virtual destination (MIDI_ROUTE_xxx) by the     //
+// aCableRoute[] table, each MIDI IN port to its cable by aPortCable[] (see  //
+// midi.c). The embedded jacks in descriptors.c must match: one pair per     //
+// cable 0..MIDI_CABLES-1, in cable order.                                   //
+//---------------------------------------------------------------------------//
+#define MIDI_PORT_UART0 0                   // Port 0: P0.4 TX, P0.5 RX
+#define MIDI_PORT_UART1 1                   // Port 1: P0.6 TX, P0.7 RX (*)
+#define MIDI_PORTS      2                   // Physical MIDI IN/OUT ports
+#define MIDI_ROUTE_LOOP 0x10                // Back to the host, same cable
+#define MIDI_ROUTE_DROP 0xFF                // Cable is not used: drop event
+#define MIDI_CABLES     3                   // OUT EP cables in descriptors.c
+
+//---------------------------------------------------------------------------//
+// Software MIDI IN ports (IN only, no MIDI OUT jack): PCA0 modules 0..n-1   //
+// capture both edges of CEX0..CEXn-1, the PCA0 ISR rebuilds 8-N-1 bytes     //
+// from edge timestamps. PCA0 runs at SYSCLK/12, one MIDI bit is 128 counts. //
+// Module 4 is the stop bit timer. They are ports MIDI_PORT_SOFT0.. on USB   //
+// cables MIDI_CABLES.. (IN EP only).                                        //
+// (*) The crossbar puts CEX pins before UART1: with n soft ports CEX0..n-1  //
+// take P0.6, P0.7, P1.2 (LEDs skipped) and UART1 moves to the next 2 pins.  //
+//---------------------------------------------------------------------------//
+#ifndef MIDI_SOFT_PORTS
+#define MIDI_SOFT_PORTS 0                   // Extra MIDI IN ports (0..3)
+#endif
+#define MIDI_PORT_SOFT0 MIDI_PORTS          // Port number of CEX0 input
+#define MIDI_IN_PORTS   (MIDI_PORTS + MIDI_SOFT_PORTS)
+#define MIDI_CABLES_IN  (MIDI_CABLES + MIDI_SOFT_PORTS) // IN EP cables
+#define SOFT_BIT        128                 // PCA0 counts per bit (4MHz)
+#define MIDI_LOOP_SIZE  16                  // Loopback queue, events (2^n)
+#define MIDI_LOOP_MASK  (MIDI_LOOP_SIZE-1)
+
+//---------------------------------------------------------------------------//
+// Soft-thru (opt-in): events parsed from a MIDI IN port are merged into the //
+// MIDI OUT port given by aThruRoute[] (midi.c), next to the USB traffic.    //
+// The main loop reads the IN ring and RT queue with own tails. Whole        //
+// messages only, a SysEx is never interleaved with one of another source    //
+// (the host wins), RT bytes take the RT lane. A thru message is dropped if  //
+// more than MIDI_THRU_LATENCY byte times (320us each) are queued ahead of   //
+// it, so it is never delayed longer and never stalls the IN side. Nor does  //
+// the USB side stall thru: a host that does not read loses its oldest ones. //
+//---------------------------------------------------------------------------//
+#ifndef MIDI_SOFT_THRU
+#define MIDI_SOFT_THRU    0                 // 1 = MIDI IN is merged to OUT
+#endif
+#ifndef MIDI_THRU_LATENCY
+#define MIDI_THRU_LATENCY 16                // Thru latency bound, byte times
+#endif
+
+//---------------------------------------------------------------------------//
+// Transform stage (opt-in): one MIDI_XFORM per MIDI IN port (MIDI->USB) and //
+// per MIDI OUT port (USB and thru ->MIDI). Each event costs the same few    //
+// table reads: message type filter, channel map (remap or drop), transpose  //
+// of note numbers and Note On velocity curve. Real-Time is never filtered.  //
+// Change transpose with no notes held, or the Note Off misses its Note On.  //
+//---------------------------------------------------------------------------//
+#ifndef MIDI_TRANSFORM
+#define MIDI_TRANSFORM  0                   // 1 = apply aXformIn/aXformOut
+#endif
+#define MIDI_XF_DROP    0xFF                // chanMap[]: channel is dropped
+#define MIDI_XF_NOTEOFF 0x01                // typeMask: Note Off
+#define MIDI_XF_NOTEON  0x02                // typeMask: Note On
+#define MIDI_XF_POLY    0x04                // typeMask: Poly Key Pressure
+#define MIDI_XF_CC      0x08                // typeMask: Control Change
+#define MIDI_XF_PROGRAM 0x10                // typeMask: Program Change
+#define MIDI_XF_CHPRESS 0x20                // typeMask: Channel Pressure
+#define MIDI_XF_BEND    0x40                // typeMask: Pitch Bend
+#define MIDI_XF_SYSTEM  0x80                // typeMask: SysEx, System Common
+#define MIDI_VEL_LINEAR 0                   // velCurve: unchanged
+#define MIDI_VEL_SOFT   1                   // velCurve: louder when soft
+#define MIDI_VEL_HARD   2                   // velCurve: needs harder play
+#define MIDI_VEL_FIXED  3                   // velCurve: always 100
+#define MIDI_VEL_CURVES 4
+
+typedef struct
+{
+	uint8_t chanMap[16];               // New channel or MIDI_XF_DROP
+	uint8_t typeMask;                  // Types passed, MIDI_XF_xxx bits
+	int8_t  transpose;                 // Added to note numbers
+	uint8_t velCurve;                  // MIDI_VEL_xxx, Note On velocity
+} MIDI_XFORM;
+
+//---------------------------------------------------------------------------//
+// Trace (opt-in): ring of 4-byte records in XRAM to see what happened when  //
+// a note hangs or a clock comes late. Record: code (MIDI_TR_xxx | port or   //
+// cable), data byte, low byte of nSystemTick, TMR2H (64us steps in the ms). //
+// TRACE_Put() runs with IRQs off for about 1us, from any ISR or main loop.  //
+// The host reads the ring by vendor requests on EP0 (needs usbconfig.h      //
+// SLAB_USB_SETUP_CMD_CB) while MIDI runs, Tools/trace.py decodes it.        //
+//---------------------------------------------------------------------------//
+#ifndef MIDI_TRACE
+#define MIDI_TRACE      0                   // 1 = record MIDI_TR_xxx events
+#endif
+#define MIDI_TRACE_SIZE 256                 // Records, 1KB XRAM (2^n)
+#define MIDI_TRACE_MASK (MIDI_TRACE_SIZE-1)
+#define MIDI_TRACE_PAGE 16                  // Records per EP0 read (64 B)
+#define MIDI_TR_RX      0x10                // UART byte received (port)
+#define MIDI_TR_TX      0x20                // UART byte sent (port)
+#define MIDI_TR_EVENT   0x30                // Event in IN ring (port), status
+#define MIDI_TR_LOST    0x40                // Event lost, IN ring full (port)
+#define MIDI_TR_WRITE   0x50                // USBD_Write(EP1IN), bytes
+#define MIDI_TR_IN_DONE 0x60                // EP1IN packet sent, bytes
+#define MIDI_TR_OUT     0x70                // EP2OUT packet taken, bytes
+#define MIDI_TR_REQ_HEAD 0x01               // Vendor request: head and size
+#define MIDI_TR_REQ_READ 0x02               // Vendor request: page wValue
+#if MIDI_TRACE
+#define TRACE(code, arg) TRACE_Put( (code), (arg) )
+#else
+#define TRACE(code, arg)
+#endif
+
+#define TIMER2_COUNTS   (48000/12)          // Timer2 counts per ms (SYSCLK/12)
+
+//---------------------------------------------------------------------------//
+// XRAM budget: the EFM8UB2 has 4KB. XRAM_RESERVED is left for the USB       //
+// library (myUsbDevice) and what the large data model puts there without a  //
+// memory type, check it in the linker map. XDATA_USED counts the XDATA      //
+// variables of main.c, init.c and midi.c in bytes, by option; change it     //
+// together with them. The event ring gets what is left, slots by options:   //
+//   512: defaults (3.6KB); MIDI_SOFT_THRU, MIDI_TRANSFORM, MIDI_RT_JITTER   //
+//        or MIDI_SOFT_PORTS 1..2 alone.                                     //
+//   256: MIDI_TX_COALESCE, MIDI_SOFT_PORTS 3 or MIDI_TRACE alone, most      //
+//        pairs, all options but the trace.                                  //
+//   128: MIDI_TRACE with MIDI_TX_COALESCE or MIDI_SOFT_PORTS 3.             //
+//---------------------------------------------------------------------------//
+#define XRAM_SIZE       4096                // EFM8UB2 on-chip XRAM
+#define XRAM_RESERVED   256                 // USB library, large model data
+#define XDATA_MAIN      (MIDI_RTQ_SIZE*2 + MIDI_LOOP_SIZE*4 \
+                         + MIDI_IN_PORTS*MIDI_RAW_SIZE*2 + USB_BUF_SIZE \
+                         + MIDI_BUF_SIZE + 20)
+#define XDATA_UART      (MIDI_PORTS*(MIDI_LANES*MIDI_LANE_SIZE*6 \
+                         + MIDI_LANES*3 + UART_RT_SIZE + 12) + 2 \
+                         + (MIDI_SOFT_PORTS ? 2 : 0))
+#define XDATA_MIDI      (MIDI_IN_PORTS*10 + MIDI_PORTS*3)
+#define XDATA_OPTIONS   ((MIDI_RT_JITTER ? MIDI_PORTS*UART_RT_SIZE*3 \
+                                           + MIDI_RT_BINS*2 : 0) \
+                         + (MIDI_TX_COALESCE ? MIDI_PORTS*(32 \
+                                               + MIDI_COAL_SIZE) : 0) \
+                         + (MIDI_TRANSFORM ? (MIDI_IN_PORTS \
+                                              + MIDI_PORTS)*19 + 6 : 0) \
+                         + (MIDI_SOFT_THRU ? MIDI_IN_PORTS + 6 : 0) \
+                         + (MIDI_TRACE ? MIDI_TRACE_SIZE*4 + 4 : 0))
+#define XDATA_FREE      (XRAM_SIZE - XRAM_RESERVED - XDATA_MAIN - XDATA_UART \
+                         - XDATA_MIDI - XDATA_OPTIONS) // For the event ring
+#ifndef MIDI_RING_SIZE
+#if XDATA_FREE >= 512*4
+#define MIDI_RING_SIZE  512                 // Slots (2^n)
+#elif XDATA_FREE >= 256*4
+#define MIDI_RING_SIZE  256
+#else
+#define MIDI_RING_SIZE  128
+#endif
+#endif
+#define XDATA_USED      (XRAM_SIZE - XRAM_RESERVED - XDATA_FREE \
+                         + MIDI_RING_SIZE*4)
+#if XDATA_USED > XRAM_SIZE - XRAM_RESERVED
+#error "XDATA is full: turn options off (globals.h)"
+#endif
+
+extern volatile SI_SEG_IDATA uint16_t nSystemTick;
 extern volatile SI_SEG_IDATA uint8_t nUsbCount;
-extern volatile SI_SEG_IDATA uint8_t nMidiCount;
-extern volatile SI_SEG_IDATA uint8_t nMidiRTMsg;
+extern volatile SI_SEG_IDATA uint8_t nUsbFrame;
+extern volatile              bool    bMidiUrgent;
+extern volatile SI_SEG_IDATA MIDI_RING_INDEX nMidiHead;
+extern volatile SI_SEG_IDATA MIDI_RING_INDEX nMidiTail;
+extern          SI_SEG_XDATA MIDI_RING_INDEX nMidiRingPeak;
+extern          SI_SEG_XDATA uint16_t nMidiRingLost;
+extern          SI_SEG_XDATA uint16_t nMidiInFiltered;
+extern volatile SI_SEG_IDATA uint8_t nMidiRTHead;
+extern volatile SI_SEG_IDATA uint8_t nMidiRTTail;
+extern volatile SI_SEG_IDATA MIDI_RING_INDEX nMidiThruTail;
+extern volatile SI_SEG_IDATA uint8_t nMidiRTThruTail;
+extern          SI_SEG_XDATA uint16_t nThruDropped;
+extern volatile SI_SEG_XDATA uint16_t nMidiRTDropped;
+extern volatile SI_SEG_XDATA uint16_t nMidiRTMerged;
+extern          SI_SEG_XDATA uint16_t nMidiOutEvents;
+extern volatile SI_SEG_XDATA uint16_t nMidiOutBytes;
+extern volatile SI_SEG_XDATA uint16_t nMidiOutSaved;
+extern          SI_SEG_XDATA uint16_t nUsbInPackets;
+extern volatile SI_SEG_XDATA uint16_t nUsbOutPackets;
+extern volatile SI_SEG_XDATA uint8_t  aTxLanePeak[MIDI_PORTS][MIDI_LANES];
+extern volatile SI_SEG_XDATA uint16_t aTxLaneWait[MIDI_PORTS][MIDI_LANES];
+extern          SI_SEG_XDATA uint16_t nTxCoalesced;
+extern volatile SI_SEG_XDATA uint16_t aMidiRTJitter[MIDI_RT_BINS];
 extern          SI_SEG_XDATA uint8_t aUsbBuffer [USB_BUF_SIZE];
 extern          SI_SEG_XDATA uint8_t aMidiBuffer[MIDI_BUF_SIZE];
+extern volatile SI_SEG_XDATA uint8_t aMidiRing  [MIDI_RING_SIZE][MIDI_EVENT_SIZE];
+extern volatile SI_SEG_XDATA uint8_t aMidiRTQueue[MIDI_RTQ_SIZE][2];
+extern volatile SI_SEG_IDATA uint8_t nMidiRawHead[MIDI_IN_PORTS];
+extern volatile SI_SEG_IDATA uint8_t nMidiRawTail[MIDI_IN_PORTS];
+extern volatile SI_SEG_XDATA uint8_t aMidiRaw[MIDI_IN_PORTS][MIDI_RAW_SIZE][2];
+extern volatile SI_SEG_XDATA uint16_t nMidiRawLost;
+extern          SI_SEG_IDATA uint8_t nMidiLoopHead;
+extern          SI_SEG_IDATA uint8_t nMidiLoopTail;
+extern          SI_SEG_XDATA uint8_t aMidiLoop[MIDI_LOOP_SIZE][MIDI_EVENT_SIZE];
+extern volatile SI_SEG_XDATA uint16_t nSoftRxErrors;
+extern SI_SEGMENT_VARIABLE(aPortCable[], const uint8_t, SI_SEG_CODE);
+extern          SI_SEG_XDATA MIDI_XFORM aXformIn [MIDI_IN_PORTS];
+extern          SI_SEG_XDATA MIDI_XFORM aXformOut[MIDI_PORTS];
+extern volatile SI_SEG_IDATA uint16_t nTraceHead;
+extern volatile SI_SEG_XDATA uint8_t aTrace[MIDI_TRACE_SIZE][4];
 
 extern const USBD_Init_TypeDef usbInitStruct;
 //---------------------------------------------------------------------------//
@@ -31,8 +333,19 @@ extern void SYSCLK_Init (void);
 extern void TIMER_Init  (void);
 extern void UART0_Init  (void);
 extern void UART1_Init  (void);
-extern void MIDI2USB    (uint8_t dataByte);
-extern void USB2MIDI    (uint8_t dataSize);
-extern void UART0_Write (uint8_t ch);
-extern void UART1_Write (uint8_t ch);
+extern void PCA0_Init   (void);
+extern void MIDI2USB_Block(uint8_t port, const SI_SEG_XDATA uint8_t *pRaw,
+                           uint8_t n);
+extern void MIDI2USB_Poll(void);
+extern void MIDI2USB_Timeout(void);
+extern void MIDI_XformInit(void);
+extern bool USB2MIDI    (SI_SEG_XDATA uint8_t *pEvent);
+extern bool UART_PutEvent(uint8_t port, uint8_t lane, uint8_t info,
+                          SI_SEG_XDATA uint8_t *pEvent);
+extern bool UART_WriteRT(uint8_t port, uint8_t ch);
+extern uint16_t UART_Backlog(uint8_t port, uint8_t lane);
+extern void MIDI_Thru   (void);
+extern uint16_t TIMER_GetTick(void);
+extern void TRACE_Put   (uint8_t code, uint8_t arg);
 //---------------------------------------------------------------------------//
+#endif // GLOBALS_H
@@ -16,21 +16,43 @@ void WDT_Init (void)
 
 //---------------------------------------------------------------------------//
 // Configure Ports #0, #1                                                    //
-//    Push-Pull P0.4 (TX), P0.5 (RX) for UART1, Skip unused 0..3             //
+//    Push-Pull P0.4 (TX), P0.5 (RX) for UART0 (port 0), Skip unused 0..3    //
+//    Push-Pull P0.6 (TX), P0.7 (RX) for UART1 (port 1), next after UART0    //
 //    Push-Pull P1.0 and P1.1 for LEDS                                       //
 //    Enable peripherals                                                     //
+// With MIDI_SOFT_PORTS the CEX inputs come first (crossbar priority), LEDs  //
+// are skipped and UART1 TX/RX move:                                         //
+//    1 port:  CEX0 P0.6,                       UART1 P0.7 (TX), P1.2 (RX)   //
+//    2 ports: CEX0 P0.6, CEX1 P0.7,            UART1 P1.2 (TX), P1.3 (RX)   //
+//    3 ports: CEX0 P0.6, CEX1 P0.7, CEX2 P1.2, UART1 P1.3 (TX), P1.4 (RX)   //
 //---------------------------------------------------------------------------//
 void PORT_Init (void)
 {
-	P0MDOUT = P0MDOUT_B4__PUSH_PULL;
+#if MIDI_SOFT_PORTS == 0
+	P0MDOUT = P0MDOUT_B4__PUSH_PULL | P0MDOUT_B6__PUSH_PULL;
+	P1MDOUT = P1MDOUT_B0__PUSH_PULL | P1MDOUT_B1__PUSH_PULL;
+#elif MIDI_SOFT_PORTS == 1
+	P0MDOUT = P0MDOUT_B4__PUSH_PULL | P0MDOUT_B7__PUSH_PULL;
 	P1MDOUT = P1MDOUT_B0__PUSH_PULL | P1MDOUT_B1__PUSH_PULL;
+#elif MIDI_SOFT_PORTS == 2
+	P0MDOUT = P0MDOUT_B4__PUSH_PULL;
+	P1MDOUT = P1MDOUT_B0__PUSH_PULL | P1MDOUT_B1__PUSH_PULL |
+	          P1MDOUT_B2__PUSH_PULL;
+#else
+	P0MDOUT = P0MDOUT_B4__PUSH_PULL;
+	P1MDOUT = P1MDOUT_B0__PUSH_PULL | P1MDOUT_B1__PUSH_PULL |
+	          P1MDOUT_B3__PUSH_PULL;
+#endif
 
 	P0SKIP  = P0SKIP_B0__SKIPPED | P0SKIP_B1__SKIPPED |
 	          P0SKIP_B2__SKIPPED | P0SKIP_B3__SKIPPED;
+#if MIDI_SOFT_PORTS
+	P1SKIP  = P1SKIP_B0__SKIPPED | P1SKIP_B1__SKIPPED;
+#endif
 
-	XBR0 = XBR0_URT0E__DISABLED;
-//	XBR0 = XBR0_URT0E__ENABLED;
-	XBR1 = XBR1_WEAKPUD__PULL_UPS_ENABLED | XBR1_XBARE__ENABLED;
+	XBR0 = XBR0_URT0E__ENABLED;
+	XBR1 = XBR1_WEAKPUD__PULL_UPS_ENABLED | XBR1_XBARE__ENABLED |
+	       (MIDI_SOFT_PORTS << XBR1_PCA0ME__SHIFT);   // CEX0..CEXn-1
 	XBR2 = XBR2_URT1E__ENABLED | XBR2_SMB1E__DISABLED;
 }
 
@@ -67,8 +89,9 @@ void SYSCLK_Init (void)
 //    Set Timer1 @prescaler, SYSCLK_DIV_12                                   //
 //    Clear Timer1 mode register bits                                        //
 //    Set Timer1 mode 2, 8-bit autoreload, CKCON0                            //
+// UART0 stays low priority, like UART1 and Timer2: they share the parser    //
+// rings and must never preempt each other.                                  //
 //---------------------------------------------------------------------------//
-/*
 void UART0_Init (void)
 {
 	uint8_t baudRateDiv = 4000000/31250/2;
@@ -83,10 +106,9 @@ void UART0_Init (void)
 	TCON_TR1        = true;            // Timer1 enable
 	SCON0_SMODE     = false;           // UART0 8-bit mode
 	SCON0_REN       = true;            // UART0 Receive Enable
-	IP_PS0          = true;            // UART0 high priority (PS0)
 	IE_ES0          = true;            // Enable UART0 interrupts
 }
-*/
+
 //---------------------------------------------------------------------------//
 // Configure the UART1, for <BAUDRATE> and 8-N-1.                            //
 //---------------------------------------------------------------------------//
@@ -103,48 +125,451 @@ void UART1_Init (void)
 }
 
 //---------------------------------------------------------------------------//
-static volatile bool bUartBusy = 0;
+// MIDI OUT ports (MIDI_PORT_xxx): every port has own TX lanes, RT lane and  //
+// scheduler state. UART0_ISR, UART1_ISR and Timer2_ISR are low priority and //
+// never preempt each other, so the shared helpers below need no locking.    //
+//---------------------------------------------------------------------------//
+typedef struct
+{
+	uint8_t  pos;                      // Next byte in msg[]
+	uint8_t  len;                      // Bytes in msg[]
+	uint8_t  msg[3];                   // Message on the wire
+	uint8_t  bSysEx;                   // SysEx owns the wire
+	uint8_t  bSysExDrop;               // Drop rest of a SysEx ended by F7
+	uint16_t sysExTick;                // Last SysEx slot, ms
+#if MIDI_RUNNING_STATUS
+	uint8_t  status;                   // Last status byte (0 = none)
+	uint16_t statusTick;               // When it was sent, ms
+#endif
+} UART_TX_STATE;
+
+static volatile uint8_t bUartBusy[MIDI_PORTS];
+//---------------------------------------------------------------------------//
+// TX lanes: main loop puts whole messages (one USB-MIDI event slot each) at //
+// the head, UART ISR takes them at the tail. Free running 8-bit indices     //
+// (lock-free). Slot byte 0 holds length and MIDI_TX_MORE flag.              //
+//---------------------------------------------------------------------------//
+static volatile SI_SEG_IDATA uint8_t nTxHead[MIDI_PORTS][MIDI_LANES];
+static volatile SI_SEG_IDATA uint8_t nTxTail[MIDI_PORTS][MIDI_LANES];
+static SI_SEG_XDATA uint8_t  aTxLane[MIDI_PORTS][MIDI_LANES][MIDI_LANE_SIZE][4];
+static SI_SEG_XDATA uint16_t aTxStamp[MIDI_PORTS][MIDI_LANES][MIDI_LANE_SIZE];
+static SI_SEG_XDATA UART_TX_STATE aTxState[MIDI_PORTS];
+static SI_SEG_IDATA uint8_t  txByte;      // Next byte, see UART_NextByte()
+volatile SI_SEG_XDATA uint8_t  aTxLanePeak[MIDI_PORTS][MIDI_LANES]; // Depth
+volatile SI_SEG_XDATA uint16_t aTxLaneWait[MIDI_PORTS][MIDI_LANES]; // ms
+         SI_SEG_XDATA uint16_t nTxCoalesced = 0;                    // Merged
+// Real-Time lanes, one byte per entry, always serviced first by the ISR.
+static volatile SI_SEG_IDATA uint8_t nUartRTHead[MIDI_PORTS];
+static volatile SI_SEG_IDATA uint8_t nUartRTTail[MIDI_PORTS];
+static          SI_SEG_XDATA uint8_t aUartRTBuf[MIDI_PORTS][UART_RT_SIZE];
+#if MIDI_RT_JITTER
+// Tick and Timer2 value when the RT byte was queued, delay histogram
+static SI_SEG_XDATA uint16_t aUartRTStamp[MIDI_PORTS][UART_RT_SIZE];
+static SI_SEG_XDATA uint8_t  aUartRTTick[MIDI_PORTS][UART_RT_SIZE];
+volatile SI_SEG_XDATA uint16_t aMidiRTJitter[MIDI_RT_BINS];
+
+//---------------------------------------------------------------------------//
+// Reads running Timer2 (0.25us counts), safe against low byte carry.        //
+//---------------------------------------------------------------------------//
+static uint16_t TIMER2_Read (void)
+{
+	uint8_t hi, lo;
+	do
+	{
+		hi = TMR2H;
+		lo = TMR2L;
+	} while( hi != TMR2H );
+	return ((uint16_t)hi << 8) | lo;
+}
+#endif
+
+//---------------------------------------------------------------------------//
+// Starts transmission on idle port: TI is set by software, the UART ISR     //
+// then takes the first byte. Called from the main loop and from Timer2_ISR, //
+// so IRQs are off around the test: TI set twice would overwrite SBUF.       //
+//---------------------------------------------------------------------------//
+static void UART_Start (uint8_t port)
+{
+	bool ea = IE_EA;
+
+	IE_EA = false;
+	if( !bUartBusy[port] )             // Transmitter is idle
+	{
+		bUartBusy[port] = true;        // Set UART TX flag
+		if( port == MIDI_PORT_UART0 )
+			SCON0_TI = true;           // Start TX in UART0_ISR
+		else
+			SCON1 |= SCON1_TI__SET;    // Start TX in UART1_ISR
+	}
+	IE_EA = ea;
+}
+
+#if MIDI_TX_COALESCE
+//---------------------------------------------------------------------------//
+// Latest-value-wins: index of the Voice lane slot last used by each key.    //
+// 0-15: Pitch Bend, 16-31: Channel Pressure (by channel), then a hashed     //
+// table for Control Change and Poly Pressure (channel, controller/note).    //
+// An entry may be stale or shared, so the slot is checked before use.       //
 //---------------------------------------------------------------------------//
-// Outputs character into UART0 in blocking mode.                            //
+#define TX_KEY_NONE     0xFF
+static SI_SEG_XDATA uint8_t aTxCoalesce[MIDI_PORTS][32 + MIDI_COAL_SIZE];
+
+static uint8_t UART_CoalesceKey (uint8_t status, uint8_t data0)
+{
+	switch( status & 0xF0 )
+	{
+		case 0xE0:                     // Pitch Bend
+			return status & 0x0F;
+		case 0xD0:                     // Channel Pressure
+			return 16 + (status & 0x0F);
+		case 0xB0:                     // Control Change, but not Bank Select,
+			if( data0 == 0 || data0 == 32 || data0 == 6 || data0 == 38 ||
+			    (data0 >= 64 && data0 <= 69) || data0 == 84 ||
+			    (data0 >= 96 && data0 <= 101) || data0 >= 120 )
+				return TX_KEY_NONE;    // Data Entry, switches (Sustain..
+			                           // Hold 2), Portamento Control,
+			                           // (N)RPN, Mode messages
+			/* fall through */
+		case 0xA0:                     // Poly Key Pressure
+			return 32 + ((uint8_t)(data0 + status * 13) & MIDI_COAL_MASK);
+	}
+	return TX_KEY_NONE;
+}
+
+//---------------------------------------------------------------------------//
+// Overwrites the value of a still queued message with the same key. The     //
+// port ISR is held off, so it never sends a half-updated Pitch Bend.        //
 //---------------------------------------------------------------------------//
-/*
-void UART0_Write (uint8_t ch)
+static bool UART_Coalesce (uint8_t port, uint8_t key,
+                           SI_SEG_XDATA uint8_t *pEvent)
 {
-	bUartBusy = true;                  // Set UART TX flag
-	SBUF0     = ch;                    // Write data into UART
-	while( bUartBusy );                // Wait I/O complete
+	uint8_t lane = MIDI_LANE_VOICE;
+	uint8_t idx  = aTxCoalesce[port][key];
+	uint8_t old  = idx & MIDI_LANE_MASK;
+	bool    bDone = false;
+
+	if( port == MIDI_PORT_UART0 )      // UART ISR must not take the slot
+		IE_ES0 = false;
+	else
+		EIE2 &= ~EIE2_ES1__ENABLED;
+	if( (uint8_t)(idx - nTxTail[port][lane]) <
+	    (uint8_t)(nTxHead[port][lane] - nTxTail[port][lane]) &&
+	    aTxLane[port][lane][old][1] == pEvent[1] &&
+	    (key < 32 || aTxLane[port][lane][old][2] == pEvent[2]) )
+	{
+		aTxLane[port][lane][old][2] = pEvent[2];  // Still queued: new value
+		aTxLane[port][lane][old][3] = pEvent[3];
+		bDone = true;
+	}
+	if( port == MIDI_PORT_UART0 )
+		IE_ES0 = true;
+	else
+		EIE2 |= EIE2_ES1__ENABLED;
+	return bDone;
 }
-*/
-void UART1_Write (uint8_t ch)
+#endif
+
+//---------------------------------------------------------------------------//
+// Puts MIDI message (bytes 1..3 of USB-MIDI event) into the given lane of   //
+// the port and returns at once. Returns false when the lane is full.        //
+// With MIDI_TX_COALESCE a controller value still waiting in the Voice lane  //
+// is overwritten in place by the new one instead of being appended.         //
+//---------------------------------------------------------------------------//
+bool UART_PutEvent (uint8_t port, uint8_t lane, uint8_t info,
+                    SI_SEG_XDATA uint8_t *pEvent)
 {
-	bUartBusy = true;                  // Set UART TX flag
-	SBUF1     = ch;                    // Write data into UART
-	while( bUartBusy );                // Wait I/O complete
+	uint8_t head = nTxHead[port][lane];
+	uint8_t used = head - nTxTail[port][lane];
+	uint8_t slot = head & MIDI_LANE_MASK;
+#if MIDI_TX_COALESCE
+	uint8_t key  = TX_KEY_NONE;
+
+	if( lane == MIDI_LANE_VOICE )
+	{
+		key = UART_CoalesceKey( pEvent[1], pEvent[2] );
+	}
+	if( key != TX_KEY_NONE && UART_Coalesce( port, key, pEvent ) )
+	{
+		nTxCoalesced++;
+		return true;
+	}
+#endif
+
+	if( used >= MIDI_LANE_SIZE )
+		return false;                  // Lane is full, try again later
+
+	aTxLane[port][lane][slot][0] = info;
+	aTxLane[port][lane][slot][1] = pEvent[1];
+	aTxLane[port][lane][slot][2] = pEvent[2];
+	aTxLane[port][lane][slot][3] = pEvent[3];
+	aTxStamp[port][lane][slot]   = TIMER_GetTick();
+#if MIDI_TX_COALESCE
+	if( key != TX_KEY_NONE )
+	{
+		aTxCoalesce[port][key] = head; // Newest slot of this controller
+	}
+#endif
+	if( ++used > aTxLanePeak[port][lane] )
+	{
+		aTxLanePeak[port][lane] = used;    // Queue depth statistics
+	}
+	nTxHead[port][lane] = head + 1;    // Publish message to UART ISR
+	UART_Start( port );
+	return true;
+}
+
+//---------------------------------------------------------------------------//
+// Puts Real-Time byte into the RT lane of the port. The ISR sends it right  //
+// after the byte in the shift register, ahead of all lanes. False if full.  //
+//---------------------------------------------------------------------------//
+bool UART_WriteRT (uint8_t port, uint8_t ch)
+{
+	uint8_t head = nUartRTHead[port];
+	if( (uint8_t)(head - nUartRTTail[port]) >= UART_RT_SIZE )
+		return false;                  // Lane is full, try again later
+	aUartRTBuf[port][head & UART_RT_MASK] = ch;
+#if MIDI_RT_JITTER
+	do
+	{
+		aUartRTTick[port][head & UART_RT_MASK]  = (uint8_t)nSystemTick;
+		aUartRTStamp[port][head & UART_RT_MASK] = TIMER2_Read();
+	} while( aUartRTTick[port][head & UART_RT_MASK] !=
+	         (uint8_t)nSystemTick );   // Timer2 ISR came in between
+#endif
+	nUartRTHead[port] = head + 1;      // Publish byte to UART ISR
+	UART_Start( port );
+	return true;
+}
+
+#if MIDI_SOFT_THRU
+//---------------------------------------------------------------------------//
+// Upper bound of bytes the port sends before a message put into the lane    //
+// now: RT lane, the message on the wire, lanes of the same or higher        //
+// priority and an open SysEx (it holds the wire), 3 bytes per message.      //
+//---------------------------------------------------------------------------//
+uint16_t UART_Backlog (uint8_t port, uint8_t lane)
+{
+	uint16_t bytes = 3 + (uint8_t)(nUartRTHead[port] - nUartRTTail[port]);
+	uint8_t  i;
+
+	if( aTxState[port].bSysEx )
+	{
+		lane = MIDI_LANE_SYSEX;        // Everything waits for the SysEx
+	}
+	for( i = 0; i <= lane; i++ )
+	{
+		bytes += 3 * (uint8_t)(nTxHead[port][i] - nTxTail[port][i]);
+	}
+	return bytes;
+}
+#endif
+
+//---------------------------------------------------------------------------//
+// Drops the queued rest of a SysEx that was ended by F7 on stall: data      //
+// bytes up to its own end (F7 or last slot). A new status byte (the host    //
+// took over with a new SysEx or message) stops it, that slot is kept.       //
+//---------------------------------------------------------------------------//
+static void UART_DropSysEx (UART_TX_STATE SI_SEG_XDATA *tx, uint8_t port)
+{
+	uint8_t lane = MIDI_LANE_SYSEX;
+	uint8_t slot, info, first;
+
+	while( nTxHead[port][lane] != nTxTail[port][lane] )
+	{
+		slot  = nTxTail[port][lane] & MIDI_LANE_MASK;
+		info  = aTxLane[port][lane][slot][0];
+		first = aTxLane[port][lane][slot][1];
+		if( first >= 0x80 && first != 0xF7 )
+		{
+			tx->bSysExDrop = false;    // Not a part of the old SysEx
+			return;
+		}
+		nTxTail[port][lane]++;         // Release slot to main loop
+		if( first == 0xF7 || !(info & MIDI_TX_MORE) )
+		{
+			tx->bSysExDrop = false;    // The old SysEx is gone
+			return;
+		}
+	}
+}
+
+//---------------------------------------------------------------------------//
+// Scheduler, called by the UART ISR when the previous message is on wire.   //
+// Takes the oldest message of the first non-empty lane (Note, Voice, SysEx) //
+// into msg[]. While a SysEx is open, only the SysEx lane may follow; if the //
+// host stalls for MIDI_TX_SYSEX_HOLD ms an F7 ends it and the wire is given //
+// to the rest. Data bytes of that SysEx coming later are dropped, else the  //
+// receiver would take them as running status data of another message.       //
+// Running status is applied here, in the order bytes really go out.         //
+//---------------------------------------------------------------------------//
+static bool UART_NextMsg (uint8_t port)
+{
+	UART_TX_STATE SI_SEG_XDATA *tx = &aTxState[port];
+	uint8_t  lane, slot, info;
+	uint16_t tick = nSystemTick;       // Same priority as Timer2: no tear
+
+	if( tx->bSysEx )
+	{
+		lane = MIDI_LANE_SYSEX;
+		if( nTxHead[port][lane] == nTxTail[port][lane] )
+		{
+			if( (uint16_t)(tick - tx->sysExTick) < MIDI_TX_SYSEX_HOLD )
+				return false;          // Wait for the rest of SysEx
+			tx->bSysEx     = false;    // Stalled: end it, release the wire
+			tx->bSysExDrop = true;
+			tx->msg[0]     = 0xF7;         // End Of Exclusive
+			tx->pos        = 0;
+			tx->len        = 1;
+#if MIDI_RUNNING_STATUS
+			tx->status     = 0;        // Resend status after the F7
+#endif
+			nMidiOutBytes++;
+			return true;
+		}
+	}
+	if( tx->bSysExDrop )
+	{
+		UART_DropSysEx( tx, port );
+	}
+	if( !tx->bSysEx )
+	{
+		for( lane = 0; lane < MIDI_LANES; lane++ )
+		{
+			if( nTxHead[port][lane] != nTxTail[port][lane] )
+				break;
+		}
+		if( lane == MIDI_LANES )
+			return false;              // All lanes are empty
+	}
+
+	slot       = nTxTail[port][lane] & MIDI_LANE_MASK;
+	info       = aTxLane[port][lane][slot][0];
+	tx->msg[0] = aTxLane[port][lane][slot][1];
+	tx->msg[1] = aTxLane[port][lane][slot][2];
+	tx->msg[2] = aTxLane[port][lane][slot][3];
+	if( (uint16_t)(tick - aTxStamp[port][lane][slot]) > aTxLaneWait[port][lane] )
+	{
+		aTxLaneWait[port][lane] = tick - aTxStamp[port][lane][slot];
+	}
+	nTxTail[port][lane]++;             // Release slot to main loop
+
+	tx->pos = 0;
+	tx->len = info & MIDI_TX_LEN;
+	if( lane == MIDI_LANE_SYSEX )
+	{
+		tx->bSysEx    = (info & MIDI_TX_MORE) ? true : false;
+		tx->sysExTick = tick;
+	}
+#if MIDI_RUNNING_STATUS
+	if( lane != MIDI_LANE_SYSEX && tx->msg[0] < 0xF0 )
+	{
+		if( tx->msg[0] == tx->status &&
+		    (uint16_t)(tick - tx->statusTick) < MIDI_RS_REFRESH )
+		{
+			tx->pos = 1;               // Running status: skip cmd byte
+			nMidiOutSaved++;
+		}
+		else
+		{
+			tx->status     = tx->msg[0];   // New status, send it in full
+			tx->statusTick = tick;
+		}
+	}
+	else
+	{
+		tx->status = 0;                // System Common/SysEx cancel it
+	}
+#endif
+	nMidiOutBytes += tx->len - tx->pos;
+	return true;
+}
+
+//---------------------------------------------------------------------------//
+// Picks next byte for the port into txByte: RT lane first, then the rest of //
+// the current message, then the next message. Clears busy flag when idle.   //
+//---------------------------------------------------------------------------//
+static bool UART_NextByte (uint8_t port)
+{
+	UART_TX_STATE SI_SEG_XDATA *tx = &aTxState[port];
+
+	if( nUartRTHead[port] != nUartRTTail[port] )
+	{
+		uint8_t slot = nUartRTTail[port] & UART_RT_MASK;
+		txByte = aUartRTBuf[port][slot];   // Real-Time byte goes first
+		nUartRTTail[port]++;
+		nMidiOutBytes++;
+#if MIDI_RT_JITTER
+		{
+			// Queue delay: whole ms by the tick, the rest in Timer2 counts
+			uint8_t  ms    = (uint8_t)nSystemTick - aUartRTTick[port][slot];
+			uint16_t delay = TIMER2_Read() - aUartRTStamp[port][slot];
+			if( (int16_t)delay < 0 )
+			{
+				delay += TIMER2_COUNTS;    // Timer2 reloaded meanwhile,
+				if( ms )                   // that ms is in the tick (or
+					ms--;                  // its interrupt is pending)
+			}
+			delay = ms ? MIDI_RT_BINS-1 : delay / 320; // 80us (4 counts/us)
+			aMidiRTJitter[delay < MIDI_RT_BINS ? delay : MIDI_RT_BINS-1]++;
+		}
+#endif
+		return true;
+	}
+	if( tx->pos < tx->len || UART_NextMsg( port ) )
+	{
+		txByte = tx->msg[tx->pos++];   // Next byte of current message
+		return true;
+	}
+	bUartBusy[port] = false;           // Clear TX flag (complete)
+	return false;
 }
 
 //---------------------------------------------------------------------------//
-// UART0 interrupt handler                                                   //
+// Stores received byte and its arrival time (ms) into the raw ring of the   //
+// port; the main loop parses it (MIDI2USB_Poll). Lost bytes are counted.    //
+// Only for the low priority UART ISRs, soft ports use SOFT_Put.             //
 //---------------------------------------------------------------------------//
-//#pragma vector=UART0_IRQn __interrupt void UART0_ISR(void)                 //
+static void UART_PutRaw (uint8_t port, uint8_t dataByte)
+{
+	uint8_t head = nMidiRawHead[port];
+
+	if( (uint8_t)(head - nMidiRawTail[port]) < MIDI_RAW_SIZE )
+	{
+		aMidiRaw[port][head & MIDI_RAW_MASK][0] = dataByte;
+		aMidiRaw[port][head & MIDI_RAW_MASK][1] = (uint8_t)nSystemTick;
+		nMidiRawHead[port] = head + 1;     // Publish byte
+	}
+	else
+	{
+		nMidiRawLost++;                    // Main loop is behind
+	}
+	TRACE( MIDI_TR_RX | port, dataByte );
+}
+
+//---------------------------------------------------------------------------//
+// UART0 interrupt handler (MIDI port 0)                                     //
 //---------------------------------------------------------------------------//
-/*
 SI_INTERRUPT (UART0_ISR, UART0_IRQn)
 {
 	if( SCON0_RI )                     // Check if RX flag is set
 	{
 		LED_IN    = true;              // Input LED on
 		SCON0_RI  = false;             // Clear interrupt flag
-		MIDI2USB( SBUF0 );             // Parse MIDI data
+		UART_PutRaw( MIDI_PORT_UART0, SBUF0 );  // Parsed in main loop
 	}
 	if( SCON0_TI )                     // Check if TX flag is set
 	{
 		SCON0_TI  = false;             // Clear interrupt flag
-		bUartBusy = false;             // Clear global TX flag (complete)
+		if( UART_NextByte( MIDI_PORT_UART0 ) )
+		{
+			SBUF0 = txByte;
+			TRACE( MIDI_TR_TX | MIDI_PORT_UART0, txByte );
+		}
 	}
 }
-*/
+
 //---------------------------------------------------------------------------//
-// UART1 interrupt handler (RI is cleared hardware)                          //
+// UART1 interrupt handler (MIDI port 1, RI is cleared hardware)             //
 //---------------------------------------------------------------------------//
 SI_INTERRUPT (UART1_ISR, UART1_IRQn)
 {
@@ -152,38 +577,322 @@ SI_INTERRUPT (UART1_ISR, UART1_IRQn)
 	{
 		SCON1 &= ~SCON1_RI__SET;       // Clear RI flag (no Auto clear)
 		LED_IN = true;                 // Input LED on
-		MIDI2USB( SBUF1 );             // Read MIDI data
+		UART_PutRaw( MIDI_PORT_UART1, SBUF1 );  // Parsed in main loop
 	}
 	if( SCON1 & SCON1_TI__SET )        // Check if TX flag is set
 	{
 		SCON1 &= ~SCON1_TI__SET;       // Clear TI interrupt flag
-		bUartBusy = false;             // Clear global TX flag (complete)
+		if( UART_NextByte( MIDI_PORT_UART1 ) )
+		{
+			SBUF1 = txByte;
+			TRACE( MIDI_TR_TX | MIDI_PORT_UART1, txByte );
+		}
 	}
 }
 
 //===========================================================================//
-/*
-static volatile uint16_t nSystemTick;
+volatile SI_SEG_IDATA uint16_t nSystemTick = 0;  // Milliseconds since start
+#if MIDI_SOFT_PORTS
+//---------------------------------------------------------------------------//
+// Software MIDI IN ports (see MIDI_SOFT_PORTS). PCA0 latches the counter on //
+// every edge of CEXn, so the timestamps are exact whatever the ISR latency. //
+// The PCA0 ISR is high priority: it must read each capture before the next  //
+// edge (32us), and preempts USB/UART ISRs only for a short constant path.   //
+// Per bit time it runs at most MIDI_SOFT_PORTS times for edges plus once    //
+// for the stop bit timer; an edge costs one 16-bit subtract, one division   //
+// by a power of 2 and two table reads, no loop over bits.                   //
+// Frame bits: 0 = start, 1..8 = data (LSB first), 9 = stop. A run of equal  //
+// level ends at an edge, its length in bits gives the data bits.            //
+// Complete bytes go to the raw ring of the port with their arrival time,    //
+// like UART bytes; the main loop parses them.                               //
+//---------------------------------------------------------------------------//
+#define SOFT_FRAME      (9*SOFT_BIT + SOFT_BIT/2) // Middle of stop bit
+
+typedef struct
+{
+	uint16_t tStart;                   // Start bit edge, PCA0 counts
+	uint8_t  nBit;                     // Frame bit where the level began
+	uint8_t  data;                     // Data bits received so far
+	uint8_t  bLevel;                   // Line level after the last edge
+	uint8_t  bBusy;                    // Frame in progress
+} SOFT_RX_STATE;
+
+static SI_SEG_IDATA SOFT_RX_STATE aSoftRx[MIDI_SOFT_PORTS];
+volatile SI_SEG_XDATA uint16_t nSoftRxErrors = 0; // Framing errors, overruns
+
+// Data bits sent before frame bit k (k = 0..10)
+static SI_SEGMENT_VARIABLE(aSoftMask[11], const uint8_t, SI_SEG_CODE) =
+{
+	0x00, 0x00, 0x01, 0x03, 0x07, 0x0F, 0x1F, 0x3F, 0x7F, 0xFF, 0xFF
+};
+
+//---------------------------------------------------------------------------//
+// Configure PCA0 (SYSCLK/12) for software MIDI IN ports. Watchdog is off,   //
+// so PCA0MD may be written. Module 4 is a software timer, its interrupt is  //
+// enabled only while a frame is in progress.                                //
+//---------------------------------------------------------------------------//
+void PCA0_Init (void)
+{
+	uint8_t i;
+
+	PCA0MD   = PCA0MD_CPS__SYSCLK_DIV_12;           // 4MHz, runs in idle
+	PCA0CPM0 = PCA0CPM0_CAPP__ENABLED | PCA0CPM0_CAPN__ENABLED |
+	           PCA0CPM0_ECCF__ENABLED;              // CEX0: both edges
+#if MIDI_SOFT_PORTS > 1
+	PCA0CPM1 = PCA0CPM0_CAPP__ENABLED | PCA0CPM0_CAPN__ENABLED |
+	           PCA0CPM0_ECCF__ENABLED;              // CEX1: both edges
+#endif
+#if MIDI_SOFT_PORTS > 2
+	PCA0CPM2 = PCA0CPM0_CAPP__ENABLED | PCA0CPM0_CAPN__ENABLED |
+	           PCA0CPM0_ECCF__ENABLED;              // CEX2: both edges
+#endif
+	PCA0CPM4 = PCA0CPM4_ECOM__ENABLED | PCA0CPM4_MAT__ENABLED;
+	for( i = 0; i < MIDI_SOFT_PORTS; i++ )
+	{
+		aSoftRx[i].bLevel = true;      // Idle line is high
+	}
+	PCA0CN0_CR = 1;                    // Run PCA0 counter
+	EIP1      |= EIP1_PPCA0__HIGH;     // See the note above
+	EIE1      |= EIE1_EPCA0__ENABLED;  // Enable PCA0 interrupts
+}
+
+//---------------------------------------------------------------------------//
+// Stores received byte into the raw ring of soft port n (see UART_PutRaw),  //
+// high priority copy: a function is never shared between ISR levels.        //
+//---------------------------------------------------------------------------//
+static void SOFT_Put (uint8_t n, uint8_t dataByte)
+{
+	uint8_t port = MIDI_PORT_SOFT0 + n;
+	uint8_t head = nMidiRawHead[port];
+
+	if( (uint8_t)(head - nMidiRawTail[port]) < MIDI_RAW_SIZE )
+	{
+		aMidiRaw[port][head & MIDI_RAW_MASK][0] = dataByte;
+		aMidiRaw[port][head & MIDI_RAW_MASK][1] = (uint8_t)nSystemTick;
+		nMidiRawHead[port] = head + 1; // Publish byte
+	}
+	else
+	{
+		nSoftRxErrors++;               // Overrun
+	}
+}
+
+//---------------------------------------------------------------------------//
+// Ends the frame at the stop bit: the line must be high (stop bit), the     //
+// bits since the last edge are ones.                                        //
+//---------------------------------------------------------------------------//
+static void SOFT_Stop (uint8_t n)
+{
+	SOFT_RX_STATE SI_SEG_IDATA *rx = &aSoftRx[n];
+
+	if( rx->bLevel )
+	{
+		SOFT_Put( n, rx->data | (uint8_t)~aSoftMask[rx->nBit] );
+	}
+	else
+	{
+		nSoftRxErrors++;               // Stop bit is low (break)
+	}
+	rx->bBusy = false;
+}
+
+//---------------------------------------------------------------------------//
+// Edge on CEXn at PCA0 time t. Falling edge of an idle line is a start bit. //
+//---------------------------------------------------------------------------//
+static void SOFT_Edge (uint8_t n, uint16_t t)
+{
+	SOFT_RX_STATE SI_SEG_IDATA *rx = &aSoftRx[n];
+	uint16_t d = t - rx->tStart;
+	uint8_t  k = d >= SOFT_FRAME + SOFT_BIT/2 ? 10 :
+	             (uint8_t)((d + SOFT_BIT/2) / SOFT_BIT);
+
+	if( rx->bBusy )
+	{
+		if( rx->bLevel )               // Falling: bits nBit..k-1 were ones
+		{
+			if( k >= 10 )              // Next start bit, stop bit was fine
+			{
+				SOFT_Stop( n );
+			}
+			else if( k == 9 )          // Stop bit is low
+			{
+				nSoftRxErrors++;
+				rx->bBusy  = false;
+				rx->bLevel = false;
+				return;
+			}
+			else
+			{
+				rx->data  |= aSoftMask[k] & ~aSoftMask[rx->nBit];
+				rx->nBit   = k;
+				rx->bLevel = false;
+				return;
+			}
+		}
+		else                           // Rising: bits nBit..k-1 were zeros
+		{
+			if( k == 0 || k >= 10 )    // Start glitch or stop bit is low
+			{
+				if( k ) nSoftRxErrors++;
+				rx->bBusy = false;
+			}
+			rx->nBit   = k;
+			rx->bLevel = true;
+			return;
+		}
+	}
+
+	rx->bLevel = !rx->bLevel;
+	if( !rx->bLevel )                  // Start bit
+	{
+		rx->tStart = t;
+		rx->nBit   = 0;
+		rx->data   = 0;
+		rx->bBusy  = true;
+		if( !(PCA0CPM4 & PCA0CPM4_ECCF__BMASK) )   // Arm stop bit timer
+		{
+			t += SOFT_FRAME;
+			PCA0CPL4    = (uint8_t)t;  // Write low byte first (ECOM=0)
+			PCA0CPH4    = t >> 8;      // High byte sets ECOM
+			PCA0CN0_CCF4 = 0;
+			PCA0CPM4   |= PCA0CPM4_ECCF__ENABLED;
+		}
+	}
+}
+
+//---------------------------------------------------------------------------//
+// Stop bit timer: ends frames past the middle of the stop bit, then ticks   //
+// every bit time while any frame is in progress (no missed compare).        //
+//---------------------------------------------------------------------------//
+static void SOFT_Tick (void)
+{
+	uint16_t now  = PCA0CP4;
+	bool     busy = false;
+	uint8_t  n;
+
+	for( n = 0; n < MIDI_SOFT_PORTS; n++ )
+	{
+		if( aSoftRx[n].bBusy &&
+		    (int16_t)(now - aSoftRx[n].tStart) >= SOFT_FRAME )
+		{
+			SOFT_Stop( n );
+		}
+		busy |= aSoftRx[n].bBusy;
+	}
+	if( busy )
+	{
+		now     += SOFT_BIT;
+		PCA0CPL4 = (uint8_t)now;
+		PCA0CPH4 = now >> 8;
+	}
+	else
+	{
+		PCA0CPM4 &= ~PCA0CPM4_ECCF__BMASK;
+	}
+}
+
+//---------------------------------------------------------------------------//
+// PCA0 interrupt handler, high priority. Capture is read before the flag is //
+// cleared, an edge in between would be lost otherwise (it is >= 32us away). //
+//---------------------------------------------------------------------------//
+SI_INTERRUPT (PCA0_ISR, PCA0_IRQn)
+{
+	if( PCA0CN0_CCF0 )
+	{
+		uint16_t t = PCA0CP0;
+		PCA0CN0_CCF0 = 0;
+		SOFT_Edge( 0, t );
+	}
+#if MIDI_SOFT_PORTS > 1
+	if( PCA0CN0_CCF1 )
+	{
+		uint16_t t = PCA0CP1;
+		PCA0CN0_CCF1 = 0;
+		SOFT_Edge( 1, t );
+	}
+#endif
+#if MIDI_SOFT_PORTS > 2
+	if( PCA0CN0_CCF2 )
+	{
+		uint16_t t = PCA0CP2;
+		PCA0CN0_CCF2 = 0;
+		SOFT_Edge( 2, t );
+	}
+#endif
+	if( PCA0CN0_CCF4 )
+	{
+		PCA0CN0_CCF4 = 0;
+		SOFT_Tick();
+	}
+}
+#endif
+
+//---------------------------------------------------------------------------//
+// Configure Timer2 as 1ms system tick (16-bit auto-reload, SYSCLK/12).      //
 //---------------------------------------------------------------------------//
 void TIMER_Init (void)
 {
-	uint16_t div    = 65536 - 48000/12;// 1kHz
+	uint16_t div    = 65536 - TIMER2_COUNTS; // 1kHz
 	TMR2CN0         = 0;               // Timer2 SysClk/12, Auto, RunCtrl off
-	TMR2RL          = div;             // Timer2: 100kHz
+	TMR2RL          = div;             // Timer2: reload for 1ms period
 	TMR2            = div;             // Timer2 initial counter value
 	TMR2CN0_TR2     = 1;               // Run Timer2
 	IE_ET2          = 1;               // Timer2 interrupt enabled
 }
 
+//---------------------------------------------------------------------------//
+// Timer2 interrupt handler, low priority (same level as UART ISRs).         //
+//---------------------------------------------------------------------------//
 SI_INTERRUPT (Timer2_ISR, TIMER2_IRQn)
 {
-	nSystemTick++;                     // Every millisecond (1/1000s)
+	uint8_t port;
 	TMR2CN0_TF2H = 0;                  // Reset IRQ flag
-
-	if( nSystemTick==1000 )
+	nSystemTick++;                     // Every millisecond (1/1000s)
+	for( port = 0; port < MIDI_PORTS; port++ )
 	{
-		nSystemTick = 0;
-	LED_OUT = 1-LED_OUT;
+		if( aTxState[port].bSysEx )    // TX waits for the rest of SysEx
+		{
+			UART_Start( port );        // Let UART ISR check the hold time
+		}
 	}
 }
-*/
\ No newline at end of file
+
+//---------------------------------------------------------------------------//
+// Returns nSystemTick for the main loop (16-bit value, read until stable).  //
+//---------------------------------------------------------------------------//
+uint16_t TIMER_GetTick (void)
+{
+	uint16_t tick;
+	do
+	{
+		tick = nSystemTick;
+	} while( tick != nSystemTick );
+	return tick;
+}
+
+#if MIDI_TRACE
+//---------------------------------------------------------------------------//
+// Appends a trace record (see MIDI_TRACE), the oldest one is overwritten.   //
+// IRQs are off, so any ISR or the main loop may call it. If Timer2 has just //
+// overflowed and its ISR did not run yet, TMR2H is low: count that ms.      //
+//---------------------------------------------------------------------------//
+void TRACE_Put (uint8_t code, uint8_t arg)
+{
+	bool    ea = IE_EA;
+	uint8_t hi, ms;
+	uint16_t slot;
+
+	IE_EA = false;
+	hi    = TMR2H;
+	ms    = (uint8_t)nSystemTick;
+	if( TMR2CN0_TF2H && hi < 0xF8 )
+		ms++;
+	slot  = nTraceHead & MIDI_TRACE_MASK;
+	aTrace[slot][0] = code;
+	aTrace[slot][1] = arg;
+	aTrace[slot][2] = ms;
+	aTrace[slot][3] = hi;
+	nTraceHead++;
+	IE_EA = ea;
+}
+#endif
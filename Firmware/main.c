@@ -22,11 +22,178 @@
 
 // Global variables
 volatile SI_SEG_IDATA uint8_t nUsbCount  = 0;      // Data bytes in USB->MIDI
-volatile SI_SEG_IDATA uint8_t nMidiCount = 0;      // Data bytes in MIDI->USB
-volatile SI_SEG_IDATA uint8_t nMidiRTMsg = 0;      // Real-Time Message (0-none)
+volatile SI_SEG_IDATA uint8_t nUsbFrame  = 0;      // SOF counter (1ms frames)
+volatile              bool    bMidiUrgent = false; // Note-On/RT is waiting
+volatile SI_SEG_IDATA MIDI_RING_INDEX nMidiHead = 0; // MIDI->USB ring (head)
+volatile SI_SEG_IDATA MIDI_RING_INDEX nMidiTail = 0; // MIDI->USB ring (tail)
+SI_SEG_XDATA MIDI_RING_INDEX nMidiRingPeak = 0;    // Most slots ever in use
+SI_SEG_XDATA uint16_t nMidiRingLost = 0;           // Events lost (ring full)
+volatile SI_SEG_IDATA uint8_t nMidiRTHead = 0;     // Real-Time queue (producer)
+volatile SI_SEG_IDATA uint8_t nMidiRTTail = 0;     // Real-Time queue (consumer)
+#if MIDI_SOFT_THRU
+volatile SI_SEG_IDATA MIDI_RING_INDEX nMidiThruTail = 0; // MIDI->USB (thru)
+volatile SI_SEG_IDATA uint8_t nMidiRTThruTail = 0; // Real-Time queue (thru)
+#endif
+volatile SI_SEG_XDATA uint16_t nMidiRTDropped = 0; // RT bytes lost (queue full)
+volatile SI_SEG_XDATA uint16_t nMidiRTMerged  = 0; // Active Sense coalesced
+SI_SEG_XDATA uint16_t nMidiOutEvents = 0;          // USB->MIDI events sent
+volatile SI_SEG_XDATA uint16_t nMidiOutBytes = 0;  // Bytes put on MIDI OUT
+volatile SI_SEG_XDATA uint16_t nMidiOutSaved = 0;  // Status bytes not resent
+SI_SEG_XDATA uint16_t nUsbInPackets = 0;           // EP1IN packets loaded
+volatile SI_SEG_XDATA uint16_t nUsbOutPackets = 0; // EP2OUT packets taken
 SI_SEG_XDATA uint8_t aUsbBuffer [USB_BUF_SIZE];    // Buffer for USB->MIDI
-SI_SEG_XDATA uint8_t aMidiBuffer[MIDI_BUF_SIZE];   // Buffer for MIDI->USB
-SI_SEG_XDATA uint8_t aMidiRTMsg[sizeof(uint32_t)]; // MIDI_RTMsg->USB
+SI_SEG_XDATA uint8_t aMidiBuffer[MIDI_BUF_SIZE];   // IN packet for MIDI->USB
+volatile SI_SEG_XDATA uint8_t aMidiRing[MIDI_RING_SIZE][MIDI_EVENT_SIZE];
+volatile SI_SEG_XDATA uint8_t aMidiRTQueue[MIDI_RTQ_SIZE][2];
+volatile SI_SEG_IDATA uint8_t nMidiRawHead[MIDI_IN_PORTS]; // Raw ring (ISRs)
+volatile SI_SEG_IDATA uint8_t nMidiRawTail[MIDI_IN_PORTS]; // Raw ring (main)
+volatile SI_SEG_XDATA uint8_t aMidiRaw[MIDI_IN_PORTS][MIDI_RAW_SIZE][2];
+volatile SI_SEG_XDATA uint16_t nMidiRawLost = 0;  // UART bytes lost (raw ring)
+SI_SEG_IDATA uint8_t nMidiLoopHead = 0;            // Loopback queue (USB2MIDI)
+SI_SEG_IDATA uint8_t nMidiLoopTail = 0;            // Loopback queue (IN packet)
+SI_SEG_XDATA uint8_t aMidiLoop[MIDI_LOOP_SIZE][MIDI_EVENT_SIZE];
+#if MIDI_TRACE
+volatile SI_SEG_IDATA uint16_t nTraceHead = 0;     // Records since reset
+volatile SI_SEG_XDATA uint8_t aTrace[MIDI_TRACE_SIZE][4];
+#endif
+
+#if MIDI_TRACE && !SLAB_USB_SETUP_CMD_CB
+#error "MIDI_TRACE readout needs SLAB_USB_SETUP_CMD_CB in usbconfig.h"
+#endif
+
+#if MIDI_ZERO_COPY
+static bool EP2OUT_ReadEvent (SI_SEG_XDATA uint8_t *pEvent);
+#endif
+
+// State of the main loop stages
+static SI_SEG_IDATA uint8_t nWaitFrame = 0;  // Frame of oldest pending event
+static SI_SEG_IDATA uint8_t nSentFrame = 0;  // Frame of last IN packet
+static bool    bWaiting   = false;           // Events are pending
+#if MIDI_ZERO_COPY
+static bool    bUsbEvent  = false;           // Event in aUsbBuffer[] waits
+#else
+static SI_SEG_IDATA uint8_t nUsbIndex  = 0;  // Next event in aUsbBuffer[]
+#endif
+
+//---------------------------------------------------------------------------//
+// MIDI => USB stage of the main loop: builds the next EP1IN packet.         //
+//---------------------------------------------------------------------------//
+static void EP1IN_Send (void)
+{
+	MIDI_RING_INDEX nCount;
+	uint8_t nRTCount, nLoopCount;
+
+	// Both queues are filled by the parser (MIDI2USB_Poll), we only move
+	// the tails. Events are copied into the IN packet buffer and
+	// released after USBD_Write() has loaded them into the endpoint FIFO.
+	// Loopback events (see MIDI_ROUTE_LOOP) are put by the main loop.
+	nRTCount   = (uint8_t)(nMidiRTHead - nMidiRTTail);
+	nCount     = (MIDI_RING_INDEX)(nMidiHead - nMidiTail);
+	nLoopCount = (uint8_t)(nMidiLoopHead - nMidiLoopTail);
+	if( !(nRTCount || nCount || nLoopCount) )
+	{
+		bWaiting = false;
+	}
+	else if( !bWaiting )
+	{
+		bWaiting   = true;                  // Start of a new batch
+		nWaitFrame = nUsbFrame;
+	}
+	// Batching (see MIDI_FLUSH_FRAMES): flush on frame boundary, when the
+	// packet is full, or at once for urgent events on an idle bus.
+	// EP1IN is double buffered (usbconfig.h): it is not busy while one
+	// packet waits for the host, the next one is queued behind it.
+	if( bWaiting && !USBD_EpIsBusy(EP1IN) &&
+	    ( (uint8_t)(nUsbFrame - nWaitFrame) >= MIDI_FLUSH_FRAMES ||
+	      nRTCount+nCount+nLoopCount >=
+	          (uint8_t)(MIDI_BUF_SIZE/MIDI_EVENT_SIZE) ||
+	      (MIDI_FLUSH_URGENT && bMidiUrgent && nSentFrame != nUsbFrame) ) )
+	{
+		uint8_t i, j = 0, rtTail = nMidiRTTail;
+		MIDI_RING_INDEX tail = nMidiTail;
+		uint8_t loopTail = nMidiLoopTail;
+
+		//--- MIDI RTMsg => USB
+		// System Real Time messages are given priority over other messages.
+		// These single-byte messages may occure anywhere in the data stream.
+		// Each one is sent as own event (CIN 0xF) in order of arrival.
+		for(i = 0; i < nRTCount; i++, rtTail++)
+		{
+			aMidiBuffer[j++] = aMidiRTQueue[rtTail & MIDI_RTQ_MASK][0];
+			aMidiBuffer[j++] = aMidiRTQueue[rtTail & MIDI_RTQ_MASK][1];
+			aMidiBuffer[j++] = 0;           // not used
+			aMidiBuffer[j++] = 0;           // not used
+		}
+		for(i = 0; i < nCount && j < MIDI_BUF_SIZE; i++, tail++)
+		{
+			aMidiBuffer[j++] = aMidiRing[tail & MIDI_RING_MASK][0];
+			aMidiBuffer[j++] = aMidiRing[tail & MIDI_RING_MASK][1];
+			aMidiBuffer[j++] = aMidiRing[tail & MIDI_RING_MASK][2];
+			aMidiBuffer[j++] = aMidiRing[tail & MIDI_RING_MASK][3];
+		}
+		for(i = 0; i < nLoopCount && j < MIDI_BUF_SIZE; i++, loopTail++)
+		{
+			aMidiBuffer[j++] = aMidiLoop[loopTail & MIDI_LOOP_MASK][0];
+			aMidiBuffer[j++] = aMidiLoop[loopTail & MIDI_LOOP_MASK][1];
+			aMidiBuffer[j++] = aMidiLoop[loopTail & MIDI_LOOP_MASK][2];
+			aMidiBuffer[j++] = aMidiLoop[loopTail & MIDI_LOOP_MASK][3];
+		}
+		// With the trace, EP1IN completion is recorded in the callback
+		if( USB_STATUS_OK==USBD_Write(EP1IN,aMidiBuffer,j,MIDI_TRACE) )
+		{
+			TRACE( MIDI_TR_WRITE, j );
+			nMidiRTTail = rtTail;           // Release sent RT bytes
+			nMidiTail   = tail;             // Release sent slots to producer
+			nMidiLoopTail = loopTail;       // Release sent loopback events
+			nSentFrame  = nUsbFrame;
+			bMidiUrgent = false;            // Urgent events are in packet
+			nUsbInPackets++;
+			bWaiting    = false;            // Rest waits for the next frame
+		}
+		LED_IN = false;                     // Turn off input LED
+	}
+}
+
+//---------------------------------------------------------------------------//
+// USB => MIDI stage of the main loop: puts host events into the lanes.      //
+//---------------------------------------------------------------------------//
+static void EP2OUT_Take (void)
+{
+#if MIDI_ZERO_COPY
+	// The EP2OUT FIFO is the buffer: one event at a time is taken out,
+	// while a lane is full it waits in aUsbBuffer[]. Host is NAKed until
+	// the packet is drained.
+	if( bUsbEvent || EP2OUT_ReadEvent( aUsbBuffer ) )
+	{
+		LED_OUT   = true;                   // Turn on Led for New event
+		bUsbEvent = !USB2MIDI( aUsbBuffer );      // Retry, if lane is full
+		LED_OUT   = false;                  // Turn off Led, when done
+	}
+#else
+	// Every whole 4-byte event goes into its output lane. If the lane
+	// is full, the rest of the packet waits for the next pass. Until
+	// then the host is NAKed: EP2OUT is double buffered, two more 64-byte
+	// packets may wait in the FIFO, the hardware NAKs the next ones, so
+	// nothing is lost. A packet that came while no read was pending
+	// is taken by the USB ISR on the next SOF, within 1ms.
+	if( nUsbCount )
+	{
+		LED_OUT = true;                     // Turn on Led for New packet
+		while( nUsbIndex + MIDI_EVENT_SIZE <= nUsbCount &&
+		       USB2MIDI( &aUsbBuffer[nUsbIndex] ) )
+		{
+			nUsbIndex += MIDI_EVENT_SIZE;
+		}
+		if( nUsbIndex + MIDI_EVENT_SIZE > nUsbCount )
+		{
+			nUsbIndex = 0;                  // Done, a short tail is dropped
+			nUsbCount = 0;                  // Reset counter
+			USBD_Read(EP2OUT, aUsbBuffer, sizeof(aUsbBuffer), true);
+		}
+		LED_OUT = false;                    // Turn off Led, when done
+	}
+#endif
+}
 
 //---------------------------------------------------------------------------//
 //                                                                           //
@@ -36,7 +203,15 @@ int main( void )
 	WDT_Init();                             // Disable WDTimer (not used)
 	PORT_Init();                            // Initialize ports (UART, LEDs)
 	SYSCLK_Init();                          // Set system clock to 48MHz
-	UART1_Init();                           // Initialize UART @31250, 8-N-1
+	UART0_Init();                           // MIDI port 0 @31250, 8-N-1
+	UART1_Init();                           // MIDI port 1 @31250, 8-N-1
+	TIMER_Init();                           // Start 1ms system tick (Timer2)
+#if MIDI_TRANSFORM
+	MIDI_XformInit();                       // Transforms pass everything
+#endif
+#if MIDI_SOFT_PORTS
+	PCA0_Init();                            // Software MIDI IN ports (PCA0)
+#endif
 	USBD_Init( &usbInitStruct );            // Initialize USB, clock calibrate
 	LED_IN  = true;                         // Blink LED (off after usb-cfg)
 	LED_OUT = true;                         // Blink LED (off after usb-cfg)
@@ -44,50 +219,66 @@ int main( void )
 
 	while(1)
 	{
-		//--- MIDI RTMsg => USB
-		// System Real Time messages are given priority over other messages.
-		// These single-byte messages may occure anywhere in the data stream.
-		if( nMidiRTMsg )
+		//--- MIDI IN => parser
+		// The ISRs only store bytes with their arrival time, the whole batch
+		// is parsed here into the event ring and the RT queue.
+		MIDI2USB_Poll();
+#if MIDI_SOFT_THRU
+		//--- MIDI IN => MIDI OUT (soft-thru), never waits for the USB side.
+		// Without a host only thru consumes, the USB side is discarded.
+		MIDI_Thru();
+		if( USBD_GetUsbState() != USBD_STATE_CONFIGURED )
 		{
-			IE_EA  = false;                 // Begin: Critical section
-			aMidiRTMsg[0] = 0x0F;           // Cable=0, Code = 0xF
-			aMidiRTMsg[1] = nMidiRTMsg;     // Real-Time Message
-			aMidiRTMsg[2] = 0;              // not used
-			aMidiRTMsg[3] = 0;              // not used
-			if( USB_STATUS_OK==USBD_Write(EP1IN,aMidiRTMsg,sizeof(uint32_t),false) )
-			{
-				nMidiRTMsg = 0;             // Clear MIDI Real-Time Message
-			}
-			IE_EA  = true;                  // End of: Critical section
+			nMidiTail   = nMidiThruTail;
+			nMidiRTTail = nMidiRTThruTail;
 		}
+#endif
+		EP1IN_Send();                       // MIDI => USB
 
-		//--- MIDI => USB
-		if( nMidiCount >= sizeof(uint32_t) )
-		{
-			IE_EA  = false;                 // Begin: Critical section
-			if( USB_STATUS_OK==USBD_Write(EP1IN,aMidiBuffer,nMidiCount,false) )
-			{
-				nMidiCount = 0;             // Reset MIDI data byte counter
-			}
-			IE_EA  = true;                  // End of: Critical section
-			LED_IN = false;                 // Turn off input LED
-		}
+		EP2OUT_Take();                      // USB => MIDI
+	}
+}
 
-		//--- USB => MIDI
-		if( nUsbCount )
-		{
-			uint8_t i;
-			LED_OUT = true;                 // Turn on Led for New packet
-			for(i = 0; i < nUsbCount; i++)  // Process every data byte
-			{
-				USB2MIDI( aUsbBuffer[i] );  // Convert USB packet into MIDI
-			}
-			nUsbCount = 0;                  // Reset counter
-			USBD_Read(EP2OUT, aUsbBuffer, sizeof(aUsbBuffer), true);
-			LED_OUT = false;                // Turn off Led, when done
-		}
+#if MIDI_ZERO_COPY
+//---------------------------------------------------------------------------//
+// Reads next 4-byte event straight from the EP2OUT FIFO. nUsbCount keeps    //
+// the bytes left in the packet; when it is drained OPRDY is cleared and the //
+// hardware may accept the next packet. USB IRQ is off meanwhile, the USB    //
+// ISR uses INDEX and USB0ADR too. Returns false, if no event is ready.      //
+//---------------------------------------------------------------------------//
+static bool EP2OUT_ReadEvent (SI_SEG_XDATA uint8_t *pEvent)
+{
+	bool bOk = false;
+
+	USB_DisableInts();
+	USB_SetIndex( 2 );
+	if( nUsbCount == 0 && USB_EpnGetOutPacketReady() )
+	{
+		nUsbCount = USB_EpOutGetCount();    // New packet in FIFO
+		nUsbOutPackets++;
+		TRACE( MIDI_TR_OUT, nUsbCount );
+	}
+	if( nUsbCount >= MIDI_EVENT_SIZE )
+	{
+		USB_EnableReadFIFO( 2 );
+		USB_GetFIFOByte( &pEvent[0] );
+		USB_GetFIFOByte( &pEvent[1] );
+		USB_GetFIFOByte( &pEvent[2] );
+		USB_GetLastFIFOByte( &pEvent[3], 2 );
+		USB_DisableReadFIFO( 2 );
+		nUsbCount -= MIDI_EVENT_SIZE;
+		bOk = true;
+	}
+	if( nUsbCount < MIDI_EVENT_SIZE && USB_EpnGetOutPacketReady() )
+	{
+		nUsbCount = 0;                      // Drained, a short tail is dropped
+		USB_EpnClearOutPacketReady();       // Release FIFO for next packet
 	}
+	USB_EnableInts();
+	return bOk;
 }
+#endif
+
 
 //---------------------------------------------------------------------------//
 // USB API Callbacks                                                         //
@@ -109,11 +300,31 @@ void USBD_DeviceStateChangeCb(USBD_State_TypeDef oldState,
 	{
 		LED_IN  = 0;                        // Turn off LED
 		LED_OUT = 0;                        // Turn off LED
+#if !MIDI_ZERO_COPY
 		USBD_Read(EP2OUT, aUsbBuffer, sizeof(aUsbBuffer), true);
+#endif
 	}
+#if MIDI_ZERO_COPY
+	// Bus reset flushes the FIFO, forget the rest of the old packet
+	if (newState < USBD_STATE_SUSPENDED)
+	{
+		nUsbCount = 0;
+	}
+#endif
 }
 #endif // SLAB_USB_STATE_CHANGE_CB
 
+//---------------------------------------------------------------------------//
+// Start-of-Frame callback (USB ISR), sets the 1ms batching time base.       //
+//---------------------------------------------------------------------------//
+#if SLAB_USB_SOF_CB
+void USBD_SofCb(uint16_t sofNr)
+{
+	UNREFERENCED_ARGUMENT(sofNr);
+	nUsbFrame++;
+}
+#endif // SLAB_USB_SOF_CB
+
 //---------------------------------------------------------------------------//
 //                                                                           //
 //---------------------------------------------------------------------------//
@@ -129,10 +340,65 @@ uint16_t USBD_XferCompleteCb(uint8_t epAddr,
 	if( epAddr==EP2OUT && status==USB_STATUS_OK )
 	{
 		nUsbCount = xferred;
+		nUsbOutPackets++;
+		TRACE( MIDI_TR_OUT, xferred );
+	}
+#if MIDI_TRACE
+	if( epAddr==EP1IN )
+	{
+		TRACE( MIDI_TR_IN_DONE, xferred );
 	}
+#endif
 	return 0;
 }
 
+#if SLAB_USB_SETUP_CMD_CB
+//---------------------------------------------------------------------------//
+// Vendor requests (device, IN) read the trace, see MIDI_TRACE:              //
+//   MIDI_TR_REQ_HEAD: 4 bytes, head (records since reset) and ring size     //
+//   MIDI_TR_REQ_READ: page wValue, MIDI_TRACE_PAGE records of aTrace[]      //
+// Records are sent as they are, the host reads the head before and after a  //
+// page and drops records overwritten meanwhile. MIDI runs on.               //
+//---------------------------------------------------------------------------//
+USB_Status_TypeDef USBD_SetupCmdCb(SI_VARIABLE_SEGMENT_POINTER(setup,
+                                   USB_Setup_TypeDef, MEM_MODEL_SEG))
+{
+#if MIDI_TRACE
+	static SI_SEG_XDATA uint8_t aHead[4];  // Sent after return, keep it
+	uint16_t len = setup->wLength;
+
+	if( setup->bmRequestType.Type      != USB_SETUP_TYPE_VENDOR ||
+	    setup->bmRequestType.Recipient != USB_SETUP_RECIPIENT_DEVICE ||
+	    setup->bmRequestType.Direction != USB_SETUP_DIR_IN )
+	{
+		return USB_STATUS_REQ_UNHANDLED;
+	}
+	if( setup->bRequest == MIDI_TR_REQ_HEAD )
+	{
+		aHead[0] = (uint8_t)nTraceHead;     // UART ISRs can not preempt
+		aHead[1] = (uint8_t)(nTraceHead >> 8);
+		aHead[2] = (uint8_t)MIDI_TRACE_SIZE;
+		aHead[3] = (uint8_t)(MIDI_TRACE_SIZE >> 8);
+		USBD_Write(EP0, aHead, (len < 4) ? len : 4, false);
+		return USB_STATUS_OK;
+	}
+	if( setup->bRequest == MIDI_TR_REQ_READ &&
+	    setup->wValue < MIDI_TRACE_SIZE / MIDI_TRACE_PAGE )
+	{
+		if( len > MIDI_TRACE_PAGE * 4 )
+			len = MIDI_TRACE_PAGE * 4;
+		USBD_Write(EP0, (SI_SEG_XDATA uint8_t *)
+		           aTrace[setup->wValue * MIDI_TRACE_PAGE], len, false);
+		return USB_STATUS_OK;
+	}
+	return USB_STATUS_REQ_ERR;
+#else
+	UNREFERENCED_ARGUMENT(setup);
+	return USB_STATUS_REQ_UNHANDLED;
+#endif
+}
+#endif // SLAB_USB_SETUP_CMD_CB
+
 //---------------------------------------------------------------------------//
 #ifndef NDEBUG
 void slab_Assert()
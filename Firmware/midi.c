@@ -46,7 +46,6 @@
 
 typedef enum {
 	MIDI_STATE_IDLE = 0,               // Parser is idle/ready (in/out)
-	MIDI_STATE_STATUS,                 // Read Status/Command byte (out)
 	MIDI_STATE_DATA,                   // Read single data byte
 	MIDI_STATE_DATA1,                  // Read first (1 of 2) data byte
 	MIDI_STATE_DATA2,                  // Read second (2 of 2) data byte
@@ -57,210 +56,884 @@ typedef union
 {
 	struct PACKET
 	{
-		uint8_t  cable : 4;            // Cable Number (we use #0)
-		uint8_t  cin   : 4;            // Code Index Number (cmd: 0x08)
+		uint8_t  cin;                  // Cable Number (4 MSB, we use #0)
+		                               // Code Index Number (4 LSB)
 		uint8_t  cmd;                  // MIDI command (status byte)
 		uint8_t  data[2];              // MIDI data bytes (1 or 2)
 	}midi;
 	uint8_t buffer[sizeof(struct PACKET)];
 } MIDI_EVENT_PACKET;
 
+// Code Index Numbers of SysEx event packets (midi10, p.16)
+#define MIDI_CIN_SYSEX            0x04 // SysEx starts or continues (3 bytes)
+#define MIDI_CIN_SYSEX_END1       0x05 // SysEx ends with following 1 byte
+#define MIDI_CIN_SYSEX_END2       0x06 // SysEx ends with following 2 bytes
+#define MIDI_CIN_SYSEX_END3       0x07 // SysEx ends with following 3 bytes
+#define MIDI_CIN_SINGLE_BYTE      0x0F // Single byte (unparsed MIDI data)
+
+// Partially filled SysEx packet is flushed after this idle time (1ms ticks).
+// The 1 or 2 staged bytes can't make a CIN 0x4 packet (it needs 3), so they
+// go out as Single Byte events (CIN 0xF) and the dump goes on with CIN 0x4.
+// USB MIDI 1.0 allows it (p.16), but some host drivers drop CIN 0xF or don't
+// join it to the SysEx, then a slow sender's dump arrives broken. 0 = never
+// flush: the bytes wait for the next data bytes or F7, latency is unbounded.
+#define MIDI_SYSEX_TIMEOUT        2
+
 //---------------------------------------------------------------------------//
-// MIDI (Uart RX) converter (parser), called from IRQ.                       //
-// Input: Data byte from UART (MIDI).                                        //
-// Info: see p.16 (midi10), uses 32-bit packets, added zero-padding byte.    //
-// MIDI Packet:                                                              //
-//              <status/cmd byte> [<data byte #0>, <data byte #1>]           //
+// Status byte classification, one entry per byte value (data bytes: 0).     //
+// Built by the preprocessor from the rows below, so every status byte costs //
+// one table read in both converters. MIDI 1.0: channel messages p.9 (38),   //
+// System Common p.27, Real-Time p.30, SysEx p.34; CIN: midi10 p.16.         //
+//---------------------------------------------------------------------------//
+#define MIDI_ST_CIN               0x0F // Code Index Number of the message
+#define MIDI_ST_LEN               0x30 // Data bytes after the status byte
+#define MIDI_ST_LEN1              0x10 // One data byte
+#define MIDI_ST_LEN2              0x20 // Two data bytes
+#define MIDI_ST_RT                0x40 // Real-Time: anywhere, no state change
+#define MIDI_ST_SYSEX             0x80 // SysEx start (F0) or end (F7)
+
+#define MIDI_ST_NOTE_OFF          (0x08 | MIDI_ST_LEN2)
+#define MIDI_ST_NOTE_ON           (0x09 | MIDI_ST_LEN2)
+#define MIDI_ST_AFTER_TOUCH       (0x0A | MIDI_ST_LEN2)
+#define MIDI_ST_CONTROL_CHANGE    (0x0B | MIDI_ST_LEN2)
+#define MIDI_ST_PROGRAM_CHANGE    (0x0C | MIDI_ST_LEN1)
+#define MIDI_ST_CHANNEL_PRESSURE  (0x0D | MIDI_ST_LEN1)
+#define MIDI_ST_PITCH_BEND        (0x0E | MIDI_ST_LEN2)
+#define MIDI_ST_SYSEX_START       (MIDI_CIN_SYSEX | MIDI_ST_SYSEX)
+#define MIDI_ST_TIME_CODE         (0x02 | MIDI_ST_LEN1)
+#define MIDI_ST_SONG_POSITION     (0x03 | MIDI_ST_LEN2)
+#define MIDI_ST_SONG_SELECT       (0x02 | MIDI_ST_LEN1)
+#define MIDI_ST_UNDEFINED         0x00 // F4, F5: ignored, cancel Running St.
+#define MIDI_ST_TUNE_REQUEST      (0x05)
+#define MIDI_ST_SYSEX_END         (MIDI_CIN_SYSEX_END1 | MIDI_ST_SYSEX)
+#define MIDI_ST_REAL_TIME         (MIDI_CIN_SINGLE_BYTE | MIDI_ST_RT)
+
+#define MIDI_ST_ROW16(x)          x,x,x,x, x,x,x,x, x,x,x,x, x,x,x,x
+
+// Compile-time check of the rows against the specs (size -1 if wrong)
+typedef char MIDI_ST_CHECK[
+	(MIDI_ST_NOTE_ON        & MIDI_ST_CIN) == (MIDI_NOTE_ON >> 4)    &&
+	(MIDI_ST_PITCH_BEND     & MIDI_ST_CIN) == (MIDI_PITCH_BEND >> 4) &&
+	(MIDI_ST_PROGRAM_CHANGE & MIDI_ST_LEN) == MIDI_ST_LEN1           &&
+	(MIDI_ST_TIME_CODE      & MIDI_ST_CIN) == 0x02                   &&
+	(MIDI_ST_TIME_CODE      & MIDI_ST_LEN) == MIDI_ST_LEN1           &&
+	(MIDI_ST_SONG_POSITION  & MIDI_ST_CIN) == 0x03                   &&
+	(MIDI_ST_SONG_POSITION  & MIDI_ST_LEN) == MIDI_ST_LEN2           &&
+	(MIDI_ST_SONG_SELECT    & MIDI_ST_LEN) == MIDI_ST_LEN1           &&
+	(MIDI_ST_TUNE_REQUEST   & MIDI_ST_CIN) == 0x05                   &&
+	(MIDI_ST_TUNE_REQUEST   & MIDI_ST_LEN) == 0 ? 1 : -1];
+
+static SI_SEGMENT_VARIABLE(aStatusInfo[256], const uint8_t, SI_SEG_CODE) =
+{
+	MIDI_ST_ROW16(0), MIDI_ST_ROW16(0), MIDI_ST_ROW16(0), MIDI_ST_ROW16(0),
+	MIDI_ST_ROW16(0), MIDI_ST_ROW16(0), MIDI_ST_ROW16(0), MIDI_ST_ROW16(0),
+	MIDI_ST_ROW16(MIDI_ST_NOTE_OFF),           // 0x80-0x8F
+	MIDI_ST_ROW16(MIDI_ST_NOTE_ON),            // 0x90-0x9F
+	MIDI_ST_ROW16(MIDI_ST_AFTER_TOUCH),        // 0xA0-0xAF
+	MIDI_ST_ROW16(MIDI_ST_CONTROL_CHANGE),     // 0xB0-0xBF
+	MIDI_ST_ROW16(MIDI_ST_PROGRAM_CHANGE),     // 0xC0-0xCF
+	MIDI_ST_ROW16(MIDI_ST_CHANNEL_PRESSURE),   // 0xD0-0xDF
+	MIDI_ST_ROW16(MIDI_ST_PITCH_BEND),         // 0xE0-0xEF
+	MIDI_ST_SYSEX_START,                       // 0xF0
+	MIDI_ST_TIME_CODE,                         // 0xF1
+	MIDI_ST_SONG_POSITION,                     // 0xF2
+	MIDI_ST_SONG_SELECT,                       // 0xF3
+	MIDI_ST_UNDEFINED,                         // 0xF4
+	MIDI_ST_UNDEFINED,                         // 0xF5
+	MIDI_ST_TUNE_REQUEST,                      // 0xF6
+	MIDI_ST_SYSEX_END,                         // 0xF7
+	MIDI_ST_REAL_TIME,                         // 0xF8 Clock
+	MIDI_ST_REAL_TIME,                         // 0xF9 Tick (undefined)
+	MIDI_ST_REAL_TIME,                         // 0xFA Start
+	MIDI_ST_REAL_TIME,                         // 0xFB Continue
+	MIDI_ST_REAL_TIME,                         // 0xFC Stop
+	MIDI_ST_REAL_TIME,                         // 0xFD (undefined)
+	MIDI_ST_REAL_TIME,                         // 0xFE Active Sense
+	MIDI_ST_REAL_TIME                          // 0xFF System Reset
+};
+
+//---------------------------------------------------------------------------//
+// MIDI->USB parser state, one context per MIDI IN port. The ISRs only fill  //
+// the raw rings, the parser runs in the main loop (MIDI2USB_Poll), so the   //
+// contexts, the event ring and the RT queue are used by main alone.         //
+//---------------------------------------------------------------------------//
+typedef struct
+{
+	MIDI_STATE        state;           // Finite-State-Machine variable
+	MIDI_STATE        running;         // State after message (p.5)
+	MIDI_EVENT_PACKET packet;          // Event packet under construction
+	uint8_t           nSysEx;          // SysEx bytes staged in packet
+	uint8_t           sysExTick;       // Arrival of last SysEx byte, ms
+} MIDI_RX_PORT;
+
+static SI_SEG_XDATA MIDI_RX_PORT aRxPort[MIDI_IN_PORTS];
+
+//---------------------------------------------------------------------------//
+// Routing tables (see MIDI_ROUTE_xxx). Cable numbers 0..MIDI_CABLES-1 are   //
+// the jacks in descriptors.c, the rest is never sent by a correct host.     //
+//---------------------------------------------------------------------------//
+SI_SEGMENT_VARIABLE(aPortCable[MIDI_PORTS + 3], const uint8_t, SI_SEG_CODE) =
+{
+	0,                                     // Port 0 (UART0) MIDI IN: cable 0
+	2,                                     // Port 1 (UART1) MIDI IN: cable 2
+	MIDI_CABLES + 0,                       // Port 2 (CEX0), MIDI_SOFT_PORTS
+	MIDI_CABLES + 1,                       // Port 3 (CEX1)
+	MIDI_CABLES + 2                        // Port 4 (CEX2)
+};
+
+static SI_SEGMENT_VARIABLE(aCableRoute[16], const uint8_t, SI_SEG_CODE) =
+{
+	MIDI_PORT_UART0,                       // Cable 0: MIDI OUT port 0
+	MIDI_ROUTE_LOOP,                       // Cable 1: virtual loopback
+	MIDI_PORT_UART1,                       // Cable 2: MIDI OUT port 1
+	MIDI_ROUTE_DROP, MIDI_ROUTE_DROP, MIDI_ROUTE_DROP, MIDI_ROUTE_DROP,
+	MIDI_ROUTE_DROP, MIDI_ROUTE_DROP, MIDI_ROUTE_DROP, MIDI_ROUTE_DROP,
+	MIDI_ROUTE_DROP, MIDI_ROUTE_DROP, MIDI_ROUTE_DROP, MIDI_ROUTE_DROP,
+	MIDI_ROUTE_DROP
+};
+
+#if MIDI_TRANSFORM
+//---------------------------------------------------------------------------//
+// Transform stage (see MIDI_TRANSFORM). Tables live in XDATA, so they may   //
+// be changed at run time; MIDI_XformInit() sets them to pass everything.    //
 //---------------------------------------------------------------------------//
-void MIDI2USB(uint8_t dataRX)
+SI_SEG_XDATA MIDI_XFORM aXformIn [MIDI_IN_PORTS];  // MIDI IN port -> USB
+SI_SEG_XDATA MIDI_XFORM aXformOut[MIDI_PORTS];     // -> MIDI OUT port
+SI_SEG_XDATA uint16_t nMidiInFiltered = 0;         // IN events filtered out
+
+// Message type of each Code Index Number (MIDI_XF_xxx bit)
+static SI_SEGMENT_VARIABLE(aCinType[16], const uint8_t, SI_SEG_CODE) =
+{
+	MIDI_XF_SYSTEM,  MIDI_XF_SYSTEM,  MIDI_XF_SYSTEM,  MIDI_XF_SYSTEM,
+	MIDI_XF_SYSTEM,  MIDI_XF_SYSTEM,  MIDI_XF_SYSTEM,  MIDI_XF_SYSTEM,
+	MIDI_XF_NOTEOFF, MIDI_XF_NOTEON,  MIDI_XF_POLY,    MIDI_XF_CC,
+	MIDI_XF_PROGRAM, MIDI_XF_CHPRESS, MIDI_XF_BEND,    MIDI_XF_SYSTEM
+};
+
+// Note On velocity curves, velocity 0 (Note Off) is kept
+static SI_SEGMENT_VARIABLE(aVelCurve[MIDI_VEL_CURVES][128], const uint8_t,
+                           SI_SEG_CODE) =
+{
+	{   // MIDI_VEL_LINEAR: unchanged
+		  0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,
+		 12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,
+		 24,  25,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,
+		 36,  37,  38,  39,  40,  41,  42,  43,  44,  45,  46,  47,
+		 48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,
+		 60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+		 72,  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,
+		 84,  85,  86,  87,  88,  89,  90,  91,  92,  93,  94,  95,
+		 96,  97,  98,  99, 100, 101, 102, 103, 104, 105, 106, 107,
+		108, 109, 110, 111, 112, 113, 114, 115, 116, 117, 118, 119,
+		120, 121, 122, 123, 124, 125, 126, 127
+	},
+	{   // MIDI_VEL_SOFT: 127*sqrt(v/127)
+		  0,  11,  16,  20,  23,  25,  28,  30,  32,  34,  36,  37,
+		 39,  41,  42,  44,  45,  46,  48,  49,  50,  52,  53,  54,
+		 55,  56,  57,  59,  60,  61,  62,  63,  64,  65,  66,  67,
+		 68,  69,  69,  70,  71,  72,  73,  74,  75,  76,  76,  77,
+		 78,  79,  80,  80,  81,  82,  83,  84,  84,  85,  86,  87,
+		 87,  88,  89,  89,  90,  91,  92,  92,  93,  94,  94,  95,
+		 96,  96,  97,  98,  98,  99, 100, 100, 101, 101, 102, 103,
+		103, 104, 105, 105, 106, 106, 107, 108, 108, 109, 109, 110,
+		110, 111, 112, 112, 113, 113, 114, 114, 115, 115, 116, 117,
+		117, 118, 118, 119, 119, 120, 120, 121, 121, 122, 122, 123,
+		123, 124, 124, 125, 125, 126, 126, 127
+	},
+	{   // MIDI_VEL_HARD: v*v/127
+		  0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+		  1,   1,   2,   2,   2,   2,   3,   3,   3,   3,   4,   4,
+		  5,   5,   5,   6,   6,   7,   7,   8,   8,   9,   9,  10,
+		 10,  11,  11,  12,  13,  13,  14,  15,  15,  16,  17,  17,
+		 18,  19,  20,  20,  21,  22,  23,  24,  25,  26,  26,  27,
+		 28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  39,  40,
+		 41,  42,  43,  44,  45,  47,  48,  49,  50,  52,  53,  54,
+		 56,  57,  58,  60,  61,  62,  64,  65,  67,  68,  70,  71,
+		 73,  74,  76,  77,  79,  80,  82,  84,  85,  87,  88,  90,
+		 92,  94,  95,  97,  99, 101, 102, 104, 106, 108, 110, 112,
+		113, 115, 117, 119, 121, 123, 125, 127
+	},
+	{   // MIDI_VEL_FIXED: 100
+		  0, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100, 100, 100, 100, 100, 100
+	}
+};
+
+//---------------------------------------------------------------------------//
+// Sets all transforms to identity: every type passes, channels unchanged.   //
+//---------------------------------------------------------------------------//
+static void MIDI_XformReset (MIDI_XFORM SI_SEG_XDATA *xf)
 {
-	static MIDI_STATE        state;
-	static MIDI_EVENT_PACKET packet;
+	uint8_t ch;
 
-	if( MIDI_IS_STATUS(dataRX) )            // System Real Time message (p.7)
+	for( ch = 0; ch < 16; ch++ )
 	{
-		switch( dataRX )
-		{
-			case MIDI_SYSTEM_RESET:
-				nMidiCount = 0;
-				nMidiRTMsg = dataRX;
-				state = MIDI_STATE_IDLE;
-				return;
-			case MIDI_CLOCK:
-			case MIDI_TICK:
-			case MIDI_START:
-			case MIDI_CONTINUE:
-			case MIDI_STOP:
-			case MIDI_ACTIVE_SENSE:
-				nMidiRTMsg = dataRX;
-				return;
-			default:
-				break;
-		}
+		xf->chanMap[ch] = ch;
+	}
+	xf->typeMask  = 0xFF;
+	xf->transpose = 0;
+	xf->velCurve  = MIDI_VEL_LINEAR;
+}
+
+void MIDI_XformInit (void)
+{
+	uint8_t port;
+
+	for( port = 0; port < MIDI_IN_PORTS; port++ )
+	{
+		MIDI_XformReset( &aXformIn[port] );
+	}
+	for( port = 0; port < MIDI_PORTS; port++ )
+	{
+		MIDI_XformReset( &aXformOut[port] );
 	}
+}
+
+//---------------------------------------------------------------------------//
+// Applies transform to USB-MIDI event in place, false if it is filtered.    //
+// Fixed cost: type table, channel table, one add with a bit test for the    //
+// note range and the curve table; the rules are data, not code.             //
+//---------------------------------------------------------------------------//
+static bool MIDI_Transform (MIDI_XFORM SI_SEG_XDATA *xf,
+                            SI_SEG_XDATA uint8_t *pEvent)
+{
+	uint8_t type = aCinType[pEvent[0] & 0x0F];
+	uint8_t ch, note;
+
+	if( !(xf->typeMask & type) )
+		return false;                       // Type is filtered
+	if( type == MIDI_XF_SYSTEM )
+		return true;                        // No channel
 
-	if( state == MIDI_STATE_IDLE )
+	ch = xf->chanMap[pEvent[1] & 0x0F];
+	if( ch == MIDI_XF_DROP )
+		return false;                       // Channel is filtered
+	pEvent[1] = (pEvent[1] & 0xF0) | ch;
+
+	if( type & (MIDI_XF_NOTEOFF | MIDI_XF_NOTEON | MIDI_XF_POLY) )
 	{
-		switch( GET_MIDI_CMD(dataRX) )
+		note = pEvent[2] + xf->transpose;
+		if( note & 0x80 )
+			return false;                   // Out of 0..127 range
+		pEvent[2] = note;
+		if( type == MIDI_XF_NOTEON && pEvent[3] )
 		{
-			case MIDI_NOTE_OFF:
-			case MIDI_NOTE_ON:
-			case MIDI_AFTER_TOUCH:
-			case MIDI_CONTROL_CHANGE:
-			case MIDI_PITCH_BEND:
-				packet.midi.cin = dataRX >> 4;   // Save Code Index Number (cmd)
-				packet.midi.cmd = dataRX;        // Save 'status byte' (cmd)
-				state = MIDI_STATE_DATA1;        // Step to 'data byte 1 of 2'
-				break;
-			case MIDI_PROGRAM_CHANGE:
-			case MIDI_CHANNEL_PRESSURE:
-				packet.midi.cin = dataRX >> 4;   // Save Code Index Number (cmd)
-				packet.midi.cmd = dataRX;        // Save 'status byte' (cmd)
-				state = MIDI_STATE_DATA;         // Step to single data byte
-				break;
-			case MIDI_SYSEX_START:
-				switch( dataRX )
-				{
-					case MIDI_SYSEX_START:       // Start SysEx stream
-						packet.midi.cin = 0;     // Default CIN #0
-						packet.midi.cmd = dataRX;
-						aMidiBuffer[nMidiCount++] = dataRX;
-						state = MIDI_STATE_SYSEX;
-						break;
-					case MIDI_TIME_CODE:
-					case MIDI_SONG_SELECT:       // Cmd with single data byte
-						packet.midi.cin = 0;
-						packet.midi.cmd = dataRX;
-						state = MIDI_STATE_DATA;
-						break;
-					case MIDI_SONG_POSITION:      // Cmd with two data bytes
-						packet.midi.cin = 0;
-						packet.midi.cmd = dataRX;
-						state = MIDI_STATE_DATA1;
-						break;
-				}
-				break;
-			default:
-				//--- unknown command: skip.
-				break;
+			note = aVelCurve[xf->velCurve][pEvent[3] & 0x7F];
+			pEvent[3] = note ? note : 1;    // Stays a Note On
 		}
 	}
-	else if( state == MIDI_STATE_DATA1 )
+	return true;
+}
+#endif
+
+//---------------------------------------------------------------------------//
+// Puts USB-MIDI Event Packet into the MIDI->USB ring (producer side), the   //
+// cable number of the port is added. Called by the parser (main loop).      //
+// The slot is filled first and then published by moving the head, so the    //
+// packet builder never sees a half-written event. If the ring is full the   //
+// event is dropped and counted, the consumer is never blocked. The fill     //
+// level is tracked as a high-water mark (nMidiRingPeak) to size the ring.   //
+// Events the transform filters out are counted apart (nMidiInFiltered).     //
+// With soft-thru a host that does not read loses its oldest event instead,  //
+// so thru goes on. Both consumers run in the main loop, as the parser does. //
+//---------------------------------------------------------------------------//
+static void MIDI_PutEvent(uint8_t port, MIDI_EVENT_PACKET * packet)
+{
+	MIDI_RING_INDEX head  = nMidiHead;
+	MIDI_RING_INDEX count = (MIDI_RING_INDEX)(head - nMidiTail);
+
+#if MIDI_SOFT_THRU
+	MIDI_RING_INDEX thru  = (MIDI_RING_INDEX)(head - nMidiThruTail);
+
+	if( count >= MIDI_RING_SIZE && thru < MIDI_RING_SIZE )
 	{
-		state = MIDI_STATE_DATA2;                // Step to 'data byte 2 of 2'
-		packet.midi.data[0] = dataRX;            // Save 'data byte 1 of 2'
+		TRACE( MIDI_TR_LOST | port, aMidiRing[head & MIDI_RING_MASK][1] );
+		nMidiTail = head - MIDI_RING_SIZE + 1;           // Host is behind:
+		nMidiRingLost++;                                 // its oldest goes
+		count--;
 	}
-	else if( state == MIDI_STATE_DATA2 )
+	if( thru > count )
+		count = thru;                                    // Slower consumer
+#endif
+	if( count < MIDI_RING_SIZE )                         // Check for free slot
 	{
-		state = MIDI_STATE_IDLE;                 // Reset state (finished)
-		packet.midi.data[1] = dataRX;            // Save 'data byte 2 of 2'
-		if( nMidiCount+4 <= MIDI_BUF_SIZE )      // Check for free space
+		aMidiRing[head & MIDI_RING_MASK][0] = packet->buffer[0] |
+		                                      (aPortCable[port] << 4);
+		aMidiRing[head & MIDI_RING_MASK][1] = packet->buffer[1];
+		aMidiRing[head & MIDI_RING_MASK][2] = packet->buffer[2];
+		aMidiRing[head & MIDI_RING_MASK][3] = packet->buffer[3];
+#if MIDI_TRANSFORM
+		// In the slot, the packet keeps the status byte for Running Status
+		if( !MIDI_Transform( &aXformIn[port], (SI_SEG_XDATA uint8_t *)
+		                     aMidiRing[head & MIDI_RING_MASK] ) )
+		{
+			nMidiInFiltered++;                           // Filtered out
+			return;
+		}
+#endif
+		nMidiHead = head + 1;                            // Publish the event
+		TRACE( MIDI_TR_EVENT | port, aMidiRing[head & MIDI_RING_MASK][1] );
+		if( count >= nMidiRingPeak )
 		{
-			// Put MIDI message into the USB stream (32-bit aligned).
-			aMidiBuffer[nMidiCount++] = packet.midi.cin;
-			aMidiBuffer[nMidiCount++] = packet.midi.cmd;
-			aMidiBuffer[nMidiCount++] = packet.midi.data[0];
-			aMidiBuffer[nMidiCount++] = packet.midi.data[1];
+			nMidiRingPeak = count + 1;                   // High-water mark
 		}
+		if( (packet->midi.cin & 0x0F) == (MIDI_NOTE_ON >> 4) &&
+		    packet->midi.data[1] )                       // Velocity > 0
+		{
+			bMidiUrgent = true;                          // Note-On: send soon
+		}
+	}
+	else
+	{
+		nMidiRingLost++;                                 // Host is behind
+		TRACE( MIDI_TR_LOST | port, packet->buffer[1] );
+	}
+}
+
+//---------------------------------------------------------------------------//
+// Closes SysEx stream: puts staged bytes (the last one is F7) into the ring //
+// with CIN 0x5, 0x6 or 0x7 (end with 1, 2 or 3 bytes), pads with zeroes.    //
+//---------------------------------------------------------------------------//
+static void MIDI_EndSysEx(uint8_t port, uint8_t nSysEx)
+{
+	MIDI_RX_PORT SI_SEG_XDATA *rx = &aRxPort[port];
+
+	rx->packet.midi.cin = MIDI_CIN_SYSEX_END1 - 1 + nSysEx;
+	while( nSysEx < sizeof(rx->packet.buffer) - 1 )
+	{
+		rx->packet.buffer[1 + nSysEx++] = 0;       // Zero padding bytes
+	}
+	MIDI_PutEvent( port, &rx->packet );
+}
+
+//---------------------------------------------------------------------------//
+// Puts System Real-Time byte into the RT queue (producer side, parser).     //
+// Arrival order is kept, Clock/Start/Stop are never merged. A repeated      //
+// Active Sense that is still waiting in the queue carries no new info, so   //
+// it is coalesced with the queued one. Lost bytes are counted. With soft-   //
+// thru the oldest byte of a host that does not read is dropped, as above.   //
+//---------------------------------------------------------------------------//
+static void MIDI_PutRTMsg(uint8_t port, uint8_t dataRX)
+{
+	uint8_t head  = nMidiRTHead;
+	uint8_t count = (uint8_t)(head - nMidiRTTail);
+	uint8_t cin   = (aPortCable[port] << 4) | MIDI_CIN_SINGLE_BYTE;
+
+#if MIDI_SOFT_THRU
+	uint8_t thru  = (uint8_t)(head - nMidiRTThruTail);
+
+	if( count >= MIDI_RTQ_SIZE && thru < MIDI_RTQ_SIZE )
+	{
+		nMidiRTTail = head - MIDI_RTQ_SIZE + 1;  // Host is behind: its
+		nMidiRTDropped++;                        // oldest byte goes
+		count--;
+	}
+	if( thru > count )
+		count = thru;                            // Slower consumer
+#endif
+	if( dataRX == MIDI_ACTIVE_SENSE && count &&
+	    aMidiRTQueue[(head - 1) & MIDI_RTQ_MASK][0] == cin &&
+	    aMidiRTQueue[(head - 1) & MIDI_RTQ_MASK][1] == MIDI_ACTIVE_SENSE )
+	{
+		nMidiRTMerged++;                         // Same byte is still queued
 	}
-	else if( state == MIDI_STATE_DATA )
+	else if( count < MIDI_RTQ_SIZE )             // Check for free entry
 	{
-		state = MIDI_STATE_IDLE;                 // Reset state (finished)
-		packet.midi.data[0] = dataRX;            // Save 'data byte 1 of 1'
-		if( nMidiCount+4 <= MIDI_BUF_SIZE )      // Check for free space
+		aMidiRTQueue[head & MIDI_RTQ_MASK][0] = cin;
+		aMidiRTQueue[head & MIDI_RTQ_MASK][1] = dataRX;
+		nMidiRTHead = head + 1;                  // Publish RT byte
+		bMidiUrgent = true;                      // Timing critical
+	}
+	else
+	{
+		nMidiRTDropped++;                        // Queue is full
+	}
+}
+
+//---------------------------------------------------------------------------//
+// SysEx flush timer, called from the main loop after the raw rings are      //
+// parsed. A slow sender can leave 1 or 2 bytes staged for a long time. When //
+// the last SysEx byte arrived MIDI_SYSEX_TIMEOUT ms ago (arrival time from  //
+// the raw ring, not parse time), they are sent as Single Byte events (CIN   //
+// 0xF), so the stream continues with CIN 0x4 packets, latency is bounded.   //
+// See MIDI_SYSEX_TIMEOUT for the host side of it.                           //
+//---------------------------------------------------------------------------//
+void MIDI2USB_Timeout(void)
+{
+#if MIDI_SYSEX_TIMEOUT
+	MIDI_EVENT_PACKET single;
+	uint8_t i, port;
+	uint8_t now = (uint8_t)TIMER_GetTick();
+
+	for(port = 0; port < MIDI_IN_PORTS; port++)
+	{
+		MIDI_RX_PORT SI_SEG_XDATA *rx = &aRxPort[port];
+
+		if( rx->state != MIDI_STATE_SYSEX || rx->nSysEx == 0 )
 		{
-			// Put MIDI message into the USB stream (zero padding).
-			aMidiBuffer[nMidiCount++] = packet.midi.cin;
-			aMidiBuffer[nMidiCount++] = packet.midi.cmd;
-			aMidiBuffer[nMidiCount++] = packet.midi.data[0];
-			aMidiBuffer[nMidiCount++] = 0;
+			continue;
 		}
+		if( (uint8_t)(now - rx->sysExTick) < MIDI_SYSEX_TIMEOUT )
+		{
+			continue;
+		}
+		single.midi.cin     = MIDI_CIN_SINGLE_BYTE;
+		single.midi.data[0] = 0;
+		single.midi.data[1] = 0;
+		for(i = 0; i < rx->nSysEx; i++)
+		{
+			single.midi.cmd = rx->packet.buffer[1 + i];
+			MIDI_PutEvent( port, &single );
+		}
+		rx->nSysEx = 0;
 	}
-	else if( state == MIDI_STATE_SYSEX )
+#endif
+}
+
+//---------------------------------------------------------------------------//
+// MIDI (Uart RX) converter (parser), called from the main loop.             //
+// Input: MIDI IN port number and n entries of its raw ring, each entry is   //
+// the data byte and its arrival time (see MIDI_RAW_SIZE). The FSM state is  //
+// loaded into locals once per batch and stored back at the end, the loop    //
+// itself touches XDATA only for the packet under construction.              //
+// Info: see p.16 (midi10), uses 32-bit packets, added zero-padding byte.    //
+// MIDI Packet:                                                              //
+//              <status/cmd byte> [<data byte #0>, <data byte #1>]           //
+// Running Status (p.5): after a Channel Message the parser stays in the     //
+// data state of the last status byte, so every following data byte pair     //
+// (or single byte) produces a new event with the same status byte.          //
+// System Common and SysEx messages cancel Running Status, Real-Time don't.  //
+// SysEx is streamed through 3 staging bytes of the packet: every full       //
+// packet goes out as CIN 0x4, F7 closes it with CIN 0x5..0x7 (p.17).        //
+//---------------------------------------------------------------------------//
+void MIDI2USB_Block(uint8_t port, const SI_SEG_XDATA uint8_t *pRaw, uint8_t n)
+{
+	MIDI_RX_PORT SI_SEG_XDATA *rx = &aRxPort[port];
+	MIDI_STATE state   = rx->state;
+	MIDI_STATE running = rx->running;
+	uint8_t    nSysEx  = rx->nSysEx;
+	uint8_t    dataRX, info;
+
+	for( ; n; n--, pRaw += 2 )
 	{
-		if( nMidiCount <= MIDI_BUF_SIZE )        // Check for free space
+		dataRX = pRaw[0];
+		info   = aStatusInfo[dataRX];            // 0 for data bytes
+
+		if( info & MIDI_ST_RT )                  // System Real Time (p.30)
+		{
+			MIDI_PutRTMsg( port, dataRX );
+			if( dataRX == MIDI_SYSTEM_RESET )
+			{
+				state = running = MIDI_STATE_IDLE;
+				nSysEx = 0;
+			}
+			continue;
+		}
+
+		if( state == MIDI_STATE_SYSEX )
+		{
+			rx->sysExTick = pRaw[1];             // Restart flush timer
+			if( MIDI_IS_DATA(dataRX) )
+			{
+				rx->packet.buffer[1 + nSysEx++] = dataRX;
+				if( nSysEx == sizeof(rx->packet.buffer) - 1 )
+				{
+					rx->packet.midi.cin = MIDI_CIN_SYSEX;  // SysEx continues
+					MIDI_PutEvent( port, &rx->packet );
+					nSysEx = 0;
+				}
+				continue;
+			}
+			// Any status byte terminates SysEx (p.34), F7 appended if missing
+			if( nSysEx == sizeof(rx->packet.buffer) - 1 )
+			{
+				rx->packet.midi.cin = MIDI_CIN_SYSEX;
+				MIDI_PutEvent( port, &rx->packet );
+				nSysEx = 0;
+			}
+			rx->packet.buffer[1 + nSysEx++] = MIDI_SYSEX_END;
+			MIDI_EndSysEx( port, nSysEx );
+			nSysEx = 0;
+			state  = MIDI_STATE_IDLE;
+			if( dataRX == MIDI_SYSEX_END )       // Exit SysEx stream (finish)
+			{
+				continue;
+			}
+		}
+
+		if( MIDI_IS_STATUS(dataRX) )             // New status byte, new message
+		{
+			rx->packet.midi.cin = info & MIDI_ST_CIN;  // Code Index Number
+			rx->packet.midi.cmd = dataRX;        // Save 'status byte' (cmd)
+			switch( info & MIDI_ST_LEN )
+			{
+				case MIDI_ST_LEN2:
+					state = MIDI_STATE_DATA1;    // To data 1 of 2
+					break;
+				case MIDI_ST_LEN1:
+					state = MIDI_STATE_DATA;     // To single byte
+					break;
+				default:
+					state = MIDI_STATE_IDLE;
+					if( info == MIDI_ST_SYSEX_START )    // Start SysEx stream
+					{
+						rx->packet.buffer[1] = dataRX;
+						rx->sysExTick = pRaw[1];
+						nSysEx = 1;
+						state  = MIDI_STATE_SYSEX;
+					}
+					else if( info == MIDI_ST_TUNE_REQUEST )  // No data bytes
+					{
+						rx->packet.midi.data[0] = 0;
+						rx->packet.midi.data[1] = 0;
+						MIDI_PutEvent( port, &rx->packet );
+					}
+					break;                       // Undefined, stray F7: skip
+			}
+			// Channel messages set Running Status, System Common cancel it
+			running = dataRX < MIDI_SYSEX_START ? state : MIDI_STATE_IDLE;
+		}
+		else if( state == MIDI_STATE_DATA1 )
 		{
-			aMidiBuffer[nMidiCount++] = dataRX;
+			state = MIDI_STATE_DATA2;            // Step to 'data byte 2 of 2'
+			rx->packet.midi.data[0] = dataRX;    // Save 'data byte 1 of 2'
 		}
-		if( dataRX == MIDI_SYSEX_END )           // Exit SysEx stream (finish)
+		else if( state == MIDI_STATE_DATA2 )
 		{
-			state = MIDI_STATE_IDLE;
+			state = running;                     // Finished, Running Status
+			rx->packet.midi.data[1] = dataRX;    // Save 'data byte 2 of 2'
+			MIDI_PutEvent( port, &rx->packet );  // Put into the USB stream
+		}
+		else if( state == MIDI_STATE_DATA )
+		{
+			state = running;                     // Finished, Running Status
+			rx->packet.midi.data[0] = dataRX;    // Save 'data byte 1 of 1'
+			rx->packet.midi.data[1] = 0;         // Zero padding byte
+			MIDI_PutEvent( port, &rx->packet );  // Put into the USB stream
 		}
 	}
+	rx->state   = state;
+	rx->running = running;
+	rx->nSysEx  = nSysEx;
 }
 
 //---------------------------------------------------------------------------//
-// USB -> MIDI Converter.                                                    //
-// Input: MIDI EVENT Packet in aUsbBuffer[]                                  //
-// USB MIDI Event Packet:                                                    //
-//     <cin, cmd> <status/cmd byte> <data byte #0> <data byte #1 or zero>    //
+// Parser stage of the main loop: takes what the ISRs have put into the raw  //
+// rings so far and parses it in contiguous blocks (a wrapped ring gives two //
+// blocks), then releases the entries. Bytes arriving meanwhile wait for the //
+// next pass. Ends with the SysEx flush timer.                               //
 //---------------------------------------------------------------------------//
-void USB2MIDI (uint8_t dataIn)
+void MIDI2USB_Poll(void)
 {
-	static MIDI_STATE state;                // Finite-State-Machine variable
+	uint8_t port, tail, pos, count, n;
 
-	if( state == MIDI_STATE_IDLE )
+	for(port = 0; port < MIDI_IN_PORTS; port++)
 	{
-		if( (dataIn >> 4)==0 )              // Check our Cable number (#0)
+		tail  = nMidiRawTail[port];
+		count = (uint8_t)(nMidiRawHead[port] - tail);
+		while( count )
 		{
-			state = MIDI_STATE_STATUS;      // Step to 'status/cmd byte' state
+			pos = tail & MIDI_RAW_MASK;
+			n   = MIDI_RAW_SIZE - pos;       // Entries up to the ring end
+			if( n > count )
+			{
+				n = count;
+			}
+			MIDI2USB_Block( port, (const SI_SEG_XDATA uint8_t *)
+			                aMidiRaw[port][pos], n );
+			tail  += n;
+			count -= n;
 		}
+		nMidiRawTail[port] = tail;           // Release parsed entries
+	}
+	MIDI2USB_Timeout();
+}
+
+//---------------------------------------------------------------------------//
+// USB -> MIDI Converter.                                                    //
+// Input: one 4-byte USB MIDI Event Packet (aligned, from aUsbBuffer[]).     //
+// USB MIDI Event Packet:                                                    //
+//     <cable, cin> <status/cmd byte> <data byte #0> <data byte #1 or zero>  //
+// The Code Index Number alone tells how many MIDI bytes follow (midi10,     //
+// p.16), so the packet is queued without a per-byte state machine.          //
+// Returns false when the output lane is full, the event is retried later.   //
+//---------------------------------------------------------------------------//
+static SI_SEGMENT_VARIABLE(aCinLength[16], const uint8_t, SI_SEG_CODE) =
+{
+	0,                                     // 0x0: Misc. function (reserved)
+	0,                                     // 0x1: Cable event (reserved)
+	2,                                     // 0x2: System Common, 2 bytes
+	3,                                     // 0x3: System Common, 3 bytes
+	3,                                     // 0x4: SysEx starts or continues
+	1,                                     // 0x5: Sys Common 1 byte/SysEx end
+	2,                                     // 0x6: SysEx ends with 2 bytes
+	3,                                     // 0x7: SysEx ends with 3 bytes
+	3,                                     // 0x8: Note Off
+	3,                                     // 0x9: Note On
+	3,                                     // 0xA: Poly Key Pressure
+	3,                                     // 0xB: Control Change
+	2,                                     // 0xC: Program Change
+	2,                                     // 0xD: Channel Pressure
+	3,                                     // 0xE: Pitch Bend
+	1                                      // 0xF: Single byte
+};
+
+//---------------------------------------------------------------------------//
+// Output sources and SysEx state of a message in the SysEx lane. Only one   //
+// source at a time may have an open SysEx on a port: the host (USB) or a    //
+// MIDI IN port (soft-thru, source number = port number).                    //
+//---------------------------------------------------------------------------//
+#define MIDI_SRC_USB    0x10               // Host, USB2MIDI()
+#define MIDI_SRC_NONE   0xFF               // No SysEx is open
+#define TX_SX_NONE      0                  // Not in SysEx lane
+#define TX_SX_START     1                  // Opens SysEx (F0 ...)
+#define TX_SX_MORE      2                  // SysEx goes on
+#define TX_SX_END       3                  // Closes SysEx or stray status
+#define TX_SX_DATA      4                  // Single data byte, no change
+
+static SI_SEG_XDATA uint8_t  txSysEx[MIDI_PORTS] =    // Owner of SysEx
+{
+	MIDI_SRC_NONE, MIDI_SRC_NONE
+};
+static SI_SEG_XDATA uint16_t txSysExTick[MIDI_PORTS];  // Its last slot, ms
+#if MIDI_TRANSFORM
+static SI_SEG_XDATA uint8_t  aTxEvent[MIDI_EVENT_SIZE]; // Transformed copy
+#endif
+
+//---------------------------------------------------------------------------//
+// Picks the output lane by message class and tells how the message changes  //
+// the SysEx state of the port (TX_SX_xxx). Not for RT bytes.                //
+//---------------------------------------------------------------------------//
+static uint8_t MIDI_TxClass (uint8_t cin, uint8_t status, uint8_t *pLane)
+{
+	*pLane = MIDI_LANE_SYSEX;
+	switch( cin )
+	{
+		case 0x08:                          // Note Off
+		case 0x09:                          // Note On
+			*pLane = MIDI_LANE_NOTE;
+			return TX_SX_NONE;
+		case MIDI_CIN_SYSEX:
+			return status == MIDI_SYSEX_START ? TX_SX_START : TX_SX_MORE;
+		case MIDI_CIN_SYSEX_END1:           // Also 1-byte System Common
+			if( MIDI_IS_STATUS(status) &&
+			    !(aStatusInfo[status] & MIDI_ST_SYSEX) )
+			{
+				*pLane = MIDI_LANE_VOICE;
+				return TX_SX_NONE;
+			}
+			/* fall through */
+		case MIDI_CIN_SYSEX_END2:
+		case MIDI_CIN_SYSEX_END3:
+			return TX_SX_END;
+		case MIDI_CIN_SINGLE_BYTE:          // Unparsed bytes stay in order
+			if( status == MIDI_SYSEX_START )
+				return TX_SX_START;
+			return MIDI_IS_STATUS(status) ? TX_SX_END : TX_SX_DATA;
+		default:                            // CIN 0x2, 0x3, 0xA-0xE
+			*pLane = MIDI_LANE_VOICE;
+			return TX_SX_NONE;
+	}
+}
+
+//---------------------------------------------------------------------------//
+// Queues one event of the given source on MIDI OUT port. A SysEx of another //
+// source holds the SysEx lane; the host may take it over when a thru SysEx  //
+// stalls for MIDI_TX_SYSEX_HOLD ms. Returns false: lane full or SysEx busy. //
+//---------------------------------------------------------------------------//
+static bool MIDI_Output (uint8_t port, uint8_t src,
+                         SI_SEG_XDATA uint8_t *pEvent)
+{
+	uint8_t cin = pEvent[0] & 0x0F, status = pEvent[1];
+	uint8_t len = aCinLength[cin];          // Number of MIDI bytes (0..3)
+	uint8_t lane, sx, owner = txSysEx[port];
+	bool    bMore = false;
+
+	if( len == 0 )
+		return true;                        // Reserved CIN: skip packet
+
+	if( cin == MIDI_CIN_SINGLE_BYTE && (aStatusInfo[status] & MIDI_ST_RT) )
+	{
+		if( !UART_WriteRT( port, status ) ) // Real-Time jumps the TX queue
+			return false;
+		nMidiOutEvents++;
+		return true;
 	}
-	else if( state == MIDI_STATE_STATUS )
+
+#if MIDI_TRANSFORM
+	// A copy: the source event may be retried when the lane is full
+	aTxEvent[0] = pEvent[0];
+	aTxEvent[1] = pEvent[1];
+	aTxEvent[2] = pEvent[2];
+	aTxEvent[3] = pEvent[3];
+	if( !MIDI_Transform( &aXformOut[port], aTxEvent ) )
+		return true;                        // Filtered out: done
+	pEvent = aTxEvent;
+#endif
+
+	sx = MIDI_TxClass( cin, status, &lane );
+	if( sx != TX_SX_NONE )
 	{
-		switch( GET_MIDI_CMD(dataIn) )
+		if( owner != MIDI_SRC_NONE && owner != src )
 		{
-			case MIDI_NOTE_OFF:
-			case MIDI_NOTE_ON:
-			case MIDI_AFTER_TOUCH:
-			case MIDI_CONTROL_CHANGE:
-			case MIDI_PITCH_BEND:
-				state = MIDI_STATE_DATA1;   // Step to first 'data byte 1/2'
-				UART1_Write( dataIn );      // Output MIDI status byte (cmd)
-				break;
-			case MIDI_PROGRAM_CHANGE:
-			case MIDI_CHANNEL_PRESSURE:
-				state = MIDI_STATE_DATA;    // Step to single 'data byte'
-				UART1_Write( dataIn );      // Output MIDI status byte (cmd)
-				break;
-			case MIDI_SYSEX_START:
-				UART1_Write( dataIn );      // Output SysEx status byte (cmd)
-				if( dataIn == MIDI_SYSEX_START )
-				{
-					state = MIDI_STATE_SYSEX;
-				}
-				break;
-			default:
-				//--- unknown command: skip.
-				state = MIDI_STATE_IDLE;
-				break;
+			if( src != MIDI_SRC_USB || (uint16_t)(TIMER_GetTick() -
+			    txSysExTick[port]) < MIDI_TX_SYSEX_HOLD )
+			{
+				return false;               // SysEx of another source
+			}
+			owner = MIDI_SRC_NONE;          // Stalled thru SysEx: take over
 		}
+		bMore = sx == TX_SX_START || sx == TX_SX_MORE ||
+		        (sx == TX_SX_DATA && owner == src);
+	}
+
+	if( !UART_PutEvent( port, lane, bMore ? len | MIDI_TX_MORE : len,
+	                    pEvent ) )
+	{
+		return false;                       // Lane is full, retry later
 	}
-	else if( state == MIDI_STATE_DATA && MIDI_IS_DATA(dataIn) )
+	if( sx != TX_SX_NONE )
 	{
-		state = MIDI_STATE_IDLE;            // End of packet (finished)
-		UART1_Write( dataIn );              // Output into MIDI this data byte
+		txSysEx[port]     = bMore ? src : MIDI_SRC_NONE;
+		txSysExTick[port] = TIMER_GetTick();
 	}
-	else if( state == MIDI_STATE_DATA1 && MIDI_IS_DATA(dataIn) )
+	nMidiOutEvents++;
+	return true;
+}
+
+//---------------------------------------------------------------------------//
+// Loopback: the event goes back to the host unchanged (same cable), it is   //
+// sent with the next IN packet. Main loop is producer and consumer.         //
+//---------------------------------------------------------------------------//
+static bool MIDI_PutLoop (SI_SEG_XDATA uint8_t *pEvent)
+{
+	uint8_t head = nMidiLoopHead;
+
+	if( (uint8_t)(head - nMidiLoopTail) >= MIDI_LOOP_SIZE )
+		return false;                       // Queue is full, retry later
+	aMidiLoop[head & MIDI_LOOP_MASK][0] = pEvent[0];
+	aMidiLoop[head & MIDI_LOOP_MASK][1] = pEvent[1];
+	aMidiLoop[head & MIDI_LOOP_MASK][2] = pEvent[2];
+	aMidiLoop[head & MIDI_LOOP_MASK][3] = pEvent[3];
+	nMidiLoopHead = head + 1;
+	return true;
+}
+
+bool USB2MIDI (SI_SEG_XDATA uint8_t *pEvent)
+{
+	uint8_t port = aCableRoute[pEvent[0] >> 4];  // Destination of this cable
+
+	if( port >= MIDI_PORTS )                // Not a MIDI OUT jack
 	{
-		state = MIDI_STATE_DATA2;           // Step to read second byte
-		UART1_Write( dataIn );              // Output into MIDI this data byte
+		if( port == MIDI_ROUTE_LOOP )
+			return MIDI_PutLoop( pEvent );
+		return true;                        // Unused cable: skip packet
 	}
-	else if( state == MIDI_STATE_DATA2 && MIDI_IS_DATA(dataIn) )
+	return MIDI_Output( port, MIDI_SRC_USB, pEvent );
+}
+
+#if MIDI_SOFT_THRU
+//---------------------------------------------------------------------------//
+// Soft-thru: MIDI OUT port for every MIDI IN port (see MIDI_SOFT_THRU).     //
+//---------------------------------------------------------------------------//
+static SI_SEGMENT_VARIABLE(aThruRoute[MIDI_PORTS + 3], const uint8_t,
+                           SI_SEG_CODE) =
+{
+	MIDI_PORT_UART0,                       // Port 0 IN -> port 0 OUT
+	MIDI_PORT_UART1,                       // Port 1 IN -> port 1 OUT
+	MIDI_ROUTE_DROP,                       // Software ports: not merged
+	MIDI_ROUTE_DROP,
+	MIDI_ROUTE_DROP
+};
+
+static SI_SEG_XDATA uint8_t aThruEvent[MIDI_EVENT_SIZE];
+static SI_SEG_XDATA uint8_t bThruSkip[MIDI_IN_PORTS];  // Drop rest of SysEx
+       SI_SEG_XDATA uint16_t nThruDropped = 0;         // Thru messages lost
+
+//---------------------------------------------------------------------------//
+// Merges one event from the MIDI IN side into its thru port. It is dropped  //
+// (never retried) when the bound MIDI_THRU_LATENCY would be exceeded, the   //
+// lane is full or the host has an open SysEx. The rest of a dropped SysEx   //
+// is skipped up to its end, a headless SysEx never goes out.                //
+//---------------------------------------------------------------------------//
+static void MIDI_ThruEvent (SI_SEG_XDATA uint8_t *pEvent)
+{
+	uint8_t in, port, lane, sx = TX_SX_NONE;
+	bool    bSend = true;
+
+	for( in = 0; in < MIDI_IN_PORTS; in++ )
 	{
-		state = MIDI_STATE_IDLE;            // End of packet (finished)
-		UART1_Write( dataIn );              // Output into MIDI this data byte
+		if( aPortCable[in] == (pEvent[0] >> 4) )
+			break;
 	}
-	else if( state == MIDI_STATE_SYSEX )
+	if( in == MIDI_IN_PORTS )
+		return;                             // Loopback cable, not an IN port
+	port = aThruRoute[in];
+	if( port >= MIDI_PORTS )
+		return;                             // Not merged
+
+	if( (pEvent[0] & 0x0F) != MIDI_CIN_SINGLE_BYTE ||
+	    !(aStatusInfo[pEvent[1]] & MIDI_ST_RT) )
 	{
-		UART1_Write( dataIn );              // Output SysEx data byte
-		if( dataIn == MIDI_SYSEX_END )      // Check for SysEx End
+		sx = MIDI_TxClass( pEvent[0] & 0x0F, pEvent[1], &lane );
+		if( bThruSkip[in] && sx != TX_SX_NONE && sx != TX_SX_START )
 		{
-			state = MIDI_STATE_IDLE;
+			if( sx == TX_SX_END )
+				bThruSkip[in] = false;      // Skipped SysEx is over
+			return;
 		}
+		bThruSkip[in] = false;
+		if( sx == TX_SX_NONE || sx == TX_SX_START )
+			bSend = UART_Backlog( port, lane ) <= MIDI_THRU_LATENCY;
+		else
+			bSend = txSysEx[port] == in;    // Own SysEx still has the lane
 	}
-	else
+	if( bSend && MIDI_Output( port, in, pEvent ) )
+		return;
+
+	nThruDropped++;                         // Late, full or SysEx cut off
+	if( sx == TX_SX_START || sx == TX_SX_MORE || sx == TX_SX_DATA )
+	{
+		bThruSkip[in] = true;
+	}
+}
+
+//---------------------------------------------------------------------------//
+// Soft-thru consumer, called from the main loop. Takes everything from the  //
+// IN ring and RT queue with own tails; RT bytes first, they go to RT lanes. //
+//---------------------------------------------------------------------------//
+void MIDI_Thru (void)
+{
+	uint8_t         tail = nMidiRTThruTail;
+	MIDI_RING_INDEX ringTail;
+
+	while( tail != nMidiRTHead )
+	{
+		aThruEvent[0] = aMidiRTQueue[tail & MIDI_RTQ_MASK][0];
+		aThruEvent[1] = aMidiRTQueue[tail & MIDI_RTQ_MASK][1];
+		aThruEvent[2] = 0;
+		aThruEvent[3] = 0;
+		MIDI_ThruEvent( aThruEvent );
+		nMidiRTThruTail = ++tail;           // Release RT entry
+	}
+	ringTail = nMidiThruTail;
+	while( ringTail != nMidiHead )
 	{
-		state = MIDI_STATE_IDLE;            // Skip unknown command
+		aThruEvent[0] = aMidiRing[ringTail & MIDI_RING_MASK][0];
+		aThruEvent[1] = aMidiRing[ringTail & MIDI_RING_MASK][1];
+		aThruEvent[2] = aMidiRing[ringTail & MIDI_RING_MASK][2];
+		aThruEvent[3] = aMidiRing[ringTail & MIDI_RING_MASK][3];
+		MIDI_ThruEvent( aThruEvent );
+		nMidiThruTail = ++ringTail;         // Release slot
 	}
 }
+#endif
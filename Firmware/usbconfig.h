@@ -28,7 +28,7 @@
 #define SLAB_USB_EP1IN_MAX_PACKET_SIZE         64
 #define SLAB_USB_EP1OUT_MAX_PACKET_SIZE        0
 #define SLAB_USB_EP2IN_MAX_PACKET_SIZE         0
-#define SLAB_USB_EP2OUT_MAX_PACKET_SIZE        8
+#define SLAB_USB_EP2OUT_MAX_PACKET_SIZE        64
 #define SLAB_USB_EP3IN_MAX_PACKET_SIZE         0
 #define SLAB_USB_EP3OUT_MAX_PACKET_SIZE        0
 // [Endpoint Max Packet Size]$
@@ -44,6 +44,26 @@
 #define SLAB_USB_EP3IN_TRANSFER_TYPE           USB_EPTYPE_ISOC
 #define SLAB_USB_EP3OUT_TRANSFER_TYPE          USB_EPTYPE_ISOC
 // [Endpoint Transfer Type]$
+// -----------------------------------------------------------------------------
+// Enable or disable double buffering of the bulk endpoints
+//
+// EP1IN: a second packet may be queued while the first one waits for the
+//        host (USBD_Write() of at most one packet, USBD_EpIsBusy() is false
+//        while a FIFO buffer is free).
+// EP2OUT: the host may send a second packet while the first one is drained.
+// Each FIFO half must hold one max size packet (64 bytes for EP1 and EP2).
+// -----------------------------------------------------------------------------
+#define SLAB_USB_EP1IN_DOUBLE_BUFFER           1
+#define SLAB_USB_EP2OUT_DOUBLE_BUFFER          1
+
+// -----------------------------------------------------------------------------
+// Fixed FIFO access for the bulk endpoints
+//
+// All USBD_Write(EP1IN) and USBD_Read(EP2OUT) buffers are in XDATA. The
+// endpoint handlers then copy with FIFO 1 and FIFO 2 and XDATA pointers,
+// without the memory type switch of the generic FIFO functions.
+// -----------------------------------------------------------------------------
+#define SLAB_USB_BULK_XDATA_FIFO               1
 
 // -----------------------------------------------------------------------------
 // Enable or disable callback functions
@@ -53,7 +73,7 @@
 #define SLAB_USB_IS_SELF_POWERED_CB            0
 #define SLAB_USB_RESET_CB                      0
 #define SLAB_USB_SETUP_CMD_CB                  0
-#define SLAB_USB_SOF_CB                        0
+#define SLAB_USB_SOF_CB                        1
 #define SLAB_USB_STATE_CHANGE_CB               1
 // [Callback Functions]$
 
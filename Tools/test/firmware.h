@@ -0,0 +1,69 @@
+//---------------------------------------------------------------------------//
+// Host build of the firmware for the tests: all modules in one unit, so     //
+// the tests see their static functions and state, plus stubs of the USB     //
+// library. The tests call the ISRs themselves. Options may be set with -D.  //
+//---------------------------------------------------------------------------//
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#define main firmware_main
+#include "init.c"
+#include "midi.c"
+#include "main.c"
+#undef main
+
+const USBD_Init_TypeDef usbInitStruct;
+USBD_State_TypeDef usbState = USBD_STATE_CONFIGURED;
+
+// Test hooks of the stubs: EP1IN reports busy while bEpInBusy is set, the
+// packets written to it go to pEpInWrite. USBD_Read(EP2OUT) sets bEpOutRead,
+// the test then puts a packet into aUsbBuffer and calls USBD_XferCompleteCb.
+static bool bEpInBusy;
+static void (*pEpInWrite)(const uint8_t *dat, uint16_t byteCount);
+static bool bEpOutRead;
+
+int8_t USBD_Init(const USBD_Init_TypeDef *p)
+{
+	UNREFERENCED_ARGUMENT(p);
+	return USB_STATUS_OK;
+}
+
+USBD_State_TypeDef USBD_GetUsbState(void)
+{
+	return usbState;
+}
+
+bool USBD_EpIsBusy(uint8_t epAddr)
+{
+	return epAddr == EP1IN && bEpInBusy;
+}
+
+int8_t USBD_Read(uint8_t epAddr, uint8_t *dat, uint16_t byteCount,
+                 bool callback)
+{
+	UNREFERENCED_ARGUMENT(dat);
+	UNREFERENCED_ARGUMENT(byteCount);
+	UNREFERENCED_ARGUMENT(callback);
+	if( epAddr == EP2OUT )
+		bEpOutRead = true;
+	return USB_STATUS_OK;
+}
+
+int8_t USBD_Write(uint8_t epAddr, uint8_t *dat, uint16_t byteCount,
+                  bool callback)
+{
+	UNREFERENCED_ARGUMENT(callback);
+	if( epAddr == EP1IN && pEpInWrite )
+		pEpInWrite( dat, byteCount );
+	return USB_STATUS_OK;
+}
+
+// State main() sets up before its loop, the tests call it first
+static void firmware_init(void)
+{
+#if MIDI_TRANSFORM
+	MIDI_XformInit();                       // Transforms pass everything
+#endif
+}
+
+#endif // FIRMWARE_H
@@ -0,0 +1,55 @@
+//---------------------------------------------------------------------------//
+// Host build of the firmware sources (Tools/test): replaces si_toolchain.h  //
+// of the SDK. Memory segments are dropped, SFRs and SFR bits are plain      //
+// variables, ISRs are plain functions the tests call themselves.            //
+//---------------------------------------------------------------------------//
+#ifndef __SI_TOOLCHAIN_H__
+#define __SI_TOOLCHAIN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SI_SEG_GENERIC
+#define SI_SEG_FAR
+#define SI_SEG_DATA
+#define SI_SEG_NEAR
+#define SI_SEG_IDATA
+#define SI_SEG_XDATA
+#define SI_SEG_PDATA
+#define SI_SEG_CODE
+#define SI_SEG_BDATA
+
+#define SI_BIT(name)              bool name
+#define SI_SBIT(name, addr, bit)  volatile bool name
+#define SI_SFR(name, addr)        volatile unsigned char name
+#define SI_SFR16(name, addr)      volatile unsigned short name
+
+#define SI_INTERRUPT(name, vector)                      void name(void)
+#define SI_INTERRUPT_PROTO(name, vector)                void name(void)
+#define SI_INTERRUPT_USING(name, vector, regnum)        void name(void)
+#define SI_INTERRUPT_PROTO_USING(name, vector, regnum)  void name(void)
+#define SI_REENTRANT_FUNCTION(name, return_type, parameter) \
+  return_type name parameter
+#define SI_REENTRANT_FUNCTION_PROTO(name, return_type, parameter) \
+  return_type name parameter
+#define SI_FUNCTION_USING(name, return_value, parameter, regnum) \
+  return_value name parameter
+#define SI_FUNCTION_PROTO_USING(name, return_value, parameter, regnum) \
+  return_value name parameter
+
+#define SI_SEGMENT_VARIABLE(name, vartype, locsegment)  vartype name
+#define SI_VARIABLE_SEGMENT_POINTER(name, vartype, targsegment) vartype * name
+#define SI_SEGMENT_VARIABLE_SEGMENT_POINTER(name, vartype, targsegment, \
+                                            locsegment) vartype * name
+#define SI_SEGMENT_POINTER(name, vartype, ptrseg) vartype * name
+#define SI_LOCATED_VARIABLE(name, vartype, locsegment, addr, init) \
+  vartype name
+#define SI_LOCATED_VARIABLE_NO_INIT(name, vartype, locsegment, addr) \
+  vartype name
+
+#define MEM_MODEL_SEG
+#define UNREFERENCED_ARGUMENT(arg) ((void)arg)
+
+#define NOP()
+
+#endif
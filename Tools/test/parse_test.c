@@ -0,0 +1,236 @@
+//---------------------------------------------------------------------------//
+// Parser test: both MIDI IN ports get a random stream at full line rate,    //
+// one byte per byte time (320us) with no gap: Channel messages under        //
+// Running Status, System Common, SysEx and Real-Time bytes anywhere, even   //
+// between data bytes. The main loop parses the raw rings (MIDI2USB_Poll)    //
+// every ms, now and then only after a 9ms stall, and the host reads all     //
+// events. Every event must come out as the MIDI 1.0 and USB-MIDI specs say, //
+// in order, and nothing may be lost in the raw rings, event ring or RT      //
+// queue.                                                                    //
+//---------------------------------------------------------------------------//
+#include <stdio.h>
+#include <string.h>
+
+#include "firmware.h"
+
+#define BYTE_US         320                 // 10 bits at 31250 baud
+#define SECONDS         20                  // Line time per port
+#define STREAM_MAX      (SECONDS * 1000000L / BYTE_US)
+#define EVENT_MAX       STREAM_MAX          // At most one event per byte
+#define STALL_EVERY     50                  // Main loop stalls every 50ms
+#define STALL_MS        9                   // Less than MIDI_RAW_SIZE bytes
+
+typedef struct
+{
+	uint8_t  wire[STREAM_MAX];              // Bytes on the MIDI IN line
+	long     nWire;
+	uint8_t  event[EVENT_MAX][4];           // Events the host must get
+	long     nEvent, nEventGot;
+	uint8_t  rt[STREAM_MAX / 8];            // Real-Time bytes, in order
+	long     nRT, nRTGot;
+	uint8_t  status;                        // Running Status of the sender
+} STREAM;
+
+static STREAM   aStream[MIDI_PORTS];
+static unsigned long seed = 1;
+static unsigned nErrors;
+
+static unsigned rnd(unsigned n)
+{
+	seed = seed * 1103515245UL + 12345;
+	return (unsigned)(seed >> 16) % n;
+}
+
+// Puts the byte on the line, with a Real-Time byte before it now and then
+static void put(STREAM *s, uint8_t b)
+{
+	static const uint8_t rt[] = { 0xF8, 0xFA, 0xFB, 0xFC };
+
+	if( rnd( 32 ) == 0 && s->nWire < STREAM_MAX - 1 )
+	{
+		s->wire[s->nWire++] = rt[rnd( sizeof(rt) )];
+		s->rt[s->nRT++]     = s->wire[s->nWire - 1];
+	}
+	s->wire[s->nWire++] = b;
+}
+
+static void expect(STREAM *s, uint8_t cable, uint8_t cin, uint8_t b1,
+                   uint8_t b2, uint8_t b3)
+{
+	s->event[s->nEvent][0] = (cable << 4) | cin;
+	s->event[s->nEvent][1] = b1;
+	s->event[s->nEvent][2] = b2;
+	s->event[s->nEvent][3] = b3;
+	s->nEvent++;
+}
+
+// Next message of the stream and the event(s) it must give
+static void message(STREAM *s, uint8_t cable)
+{
+	static const uint8_t voice[] = { 0x90, 0x90, 0x80, 0xB0, 0xE0, 0xC0,
+	                                 0xD0, 0xA0 };
+	uint8_t  status, d1 = rnd( 128 ), d2 = rnd( 128 ), sx[24];
+	unsigned kind = rnd( 100 ), n, i;
+
+	if( kind < 90 )                         // Channel message
+	{
+		status = voice[rnd( sizeof(voice) )] | rnd( 2 );
+		if( rnd( 4 ) )
+			status = s->status ? s->status : status; // Mostly the same
+		if( status != s->status )
+			put( s, status );               // Else Running Status
+		s->status = status;
+		put( s, d1 );
+		if( (status & 0xE0) == 0xC0 )       // Program Change, Pressure
+		{
+			expect( s, cable, status >> 4, status, d1, 0 );
+			return;
+		}
+		put( s, d2 );
+		expect( s, cable, status >> 4, status, d1, d2 );
+	}
+	else if( kind < 96 )                    // System Common
+	{
+		s->status = 0;                      // Cancels Running Status
+		switch( rnd( 4 ) )
+		{
+			case 0:                         // MTC Quarter Frame
+				put( s, 0xF1 );
+				put( s, d1 );
+				expect( s, cable, 0x2, 0xF1, d1, 0 );
+				break;
+			case 1:                         // Song Position Pointer
+				put( s, 0xF2 );
+				put( s, d1 );
+				put( s, d2 );
+				expect( s, cable, 0x3, 0xF2, d1, d2 );
+				break;
+			case 2:                         // Song Select
+				put( s, 0xF3 );
+				put( s, d1 );
+				expect( s, cable, 0x2, 0xF3, d1, 0 );
+				break;
+			default:                        // Tune Request
+				put( s, 0xF6 );
+				expect( s, cable, 0x5, 0xF6, 0, 0 );
+				break;
+		}
+	}
+	else                                    // SysEx, 3 bytes per event
+	{
+		s->status = 0;
+		n = 0;
+		sx[n++] = 0xF0;
+		for( i = rnd( 20 ); i; i-- )
+			sx[n++] = rnd( 128 );
+		sx[n++] = 0xF7;
+		for( i = 0; i < n; i++ )
+			put( s, sx[i] );
+		for( i = 0; n - i > 3; i += 3 )
+			expect( s, cable, 0x4, sx[i], sx[i + 1], sx[i + 2] );
+		n -= i;                             // 1..3 bytes end it
+		expect( s, cable, 0x4 + n, sx[i], n > 1 ? sx[i + 1] : 0,
+		        n > 2 ? sx[i + 2] : 0 );
+	}
+}
+
+// Host side: takes all events and RT bytes, checks them against the streams
+static void host(void)
+{
+	STREAM  *s;
+	uint8_t  port, cable;
+
+	while( nMidiTail != nMidiHead )
+	{
+		const volatile uint8_t *ev = aMidiRing[nMidiTail & MIDI_RING_MASK];
+
+		cable = ev[0] >> 4;
+		for( port = 0; port < MIDI_PORTS && aPortCable[port] != cable; )
+			port++;
+		s = &aStream[port < MIDI_PORTS ? port : 0];
+		if( port == MIDI_PORTS || s->nEventGot == s->nEvent ||
+		    memcmp( s->event[s->nEventGot], (const void *)ev, 4 ) )
+		{
+			if( nErrors++ < 10 )
+				printf("  cable %u event %ld: %02X %02X %02X %02X\n",
+				       cable, s->nEventGot, ev[0], ev[1], ev[2], ev[3]);
+		}
+		s->nEventGot++;
+		nMidiTail++;
+	}
+	while( nMidiRTTail != nMidiRTHead )
+	{
+		const volatile uint8_t *rt = aMidiRTQueue[nMidiRTTail & MIDI_RTQ_MASK];
+
+		cable = rt[0] >> 4;
+		for( port = 0; port < MIDI_PORTS && aPortCable[port] != cable; )
+			port++;
+		s = &aStream[port < MIDI_PORTS ? port : 0];
+		if( port == MIDI_PORTS || (rt[0] & 0x0F) != MIDI_CIN_SINGLE_BYTE ||
+		    s->nRTGot == s->nRT || s->rt[s->nRTGot] != rt[1] )
+		{
+			if( nErrors++ < 10 )
+				printf("  cable %u RT %ld: %02X %02X\n", cable, s->nRTGot,
+				       rt[0], rt[1]);
+		}
+		s->nRTGot++;
+		nMidiRTTail++;
+	}
+}
+
+int main(void)
+{
+	unsigned long t, ms = 0;
+	uint8_t  port;
+	STREAM  *s;
+
+	firmware_init();
+	for( port = 0; port < MIDI_PORTS; port++ )
+	{
+		s = &aStream[port];
+		while( s->nWire < STREAM_MAX - 32 )
+			message( s, aPortCable[port] );
+	}
+
+	// Byte time by byte time; the main loop runs on ms boundaries
+	for( t = 0; ; t++ )
+	{
+		bool bMore = false;
+
+		for( port = 0; port < MIDI_PORTS; port++ )
+		{
+			s = &aStream[port];
+			if( t < (unsigned long)s->nWire )
+			{
+				UART_PutRaw( port, s->wire[t] );
+				bMore = true;
+			}
+		}
+		if( (t + 1) * BYTE_US / 1000 == ms )
+			continue;
+		ms = (t + 1) * BYTE_US / 1000;
+		nSystemTick++;
+		if( bMore && ms % STALL_EVERY >= STALL_EVERY - STALL_MS )
+			continue;                       // Main loop is busy elsewhere
+		MIDI2USB_Poll();
+		host();
+		if( !bMore )
+			break;
+	}
+
+	for( port = 0; port < MIDI_PORTS; port++ )
+	{
+		s = &aStream[port];
+		printf("port %u: %ld bytes, %ld of %ld events, %ld of %ld RT\n", port,
+		       s->nWire, s->nEventGot, s->nEvent, s->nRTGot, s->nRT);
+		if( s->nEventGot != s->nEvent || s->nRTGot != s->nRT )
+			nErrors++;
+	}
+	printf("lost raw %u, ring %u, RT %u\n", (unsigned)nMidiRawLost,
+	       (unsigned)nMidiRingLost, (unsigned)nMidiRTDropped);
+	if( nMidiRawLost || nMidiRingLost || nMidiRTDropped || nMidiRTMerged )
+		nErrors++;
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
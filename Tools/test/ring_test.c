@@ -0,0 +1,205 @@
+//---------------------------------------------------------------------------//
+// Stress test of the MIDI->USB path with its two lock-free SPSC rings, each //
+// end in its own thread:                                                    //
+//   isr    - UART0/UART1 receive: UART_PutRaw into the raw rings,           //
+//   parser - main loop: MIDI2USB_Poll, raw rings -> aMidiRing,              //
+//   usb    - packet builder: takes events from aMidiRing.                   //
+// The isr thread is paced as the wire: one byte per port each 320us, it     //
+// never waits for the parser, a full raw ring loses the byte (nMidiRawLost, //
+// must stay 0). The usb thread stalls for TEST_STALL_MS once a second, so   //
+// aMidiRing fills up: an event may then be dropped (nMidiRingLost) but      //
+// never be torn, duplicated or reordered.                                   //
+// The data are Control Changes (half under Running Status) carrying a       //
+// sequence number. Relies on volatile and the store order of x86 (TSO), as  //
+// the firmware relies on the single 8051 core. Races are much more likely   //
+// with a core per thread than on a single core host.                        //
+//---------------------------------------------------------------------------//
+#define _POSIX_C_SOURCE 200112L         // clock_nanosleep
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "firmware.h"
+
+#define TEST_EVENTS     6000UL              // Messages per port, about 5s
+#define TEST_STATUS     0xB3                // Control Change, channel 4
+#define BYTE_NS         320000L             // 10 bits at 31250 baud
+#ifndef TEST_STALL_MS
+#define TEST_STALL_MS   300                 // Host stall, once a second
+#endif
+#if MIDI_TRANSFORM
+#define TEST_FILTERED   nMidiInFiltered     // Not lost, but not sent either
+#else
+#define TEST_FILTERED   0
+#endif
+
+static volatile int bParserStop;
+static volatile int bUsbStop;
+static unsigned long nErrors;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Sleeps until the byte time is due; late, it goes on from now (a wire is
+// never faster than 31250 baud)
+static void wait_until(long long *due)
+{
+	struct timespec ts;
+	long long t = now_ns();
+
+	if( *due <= t )
+	{
+		*due = t;
+		return;
+	}
+	ts.tv_sec  = *due / 1000000000LL;
+	ts.tv_nsec = *due % 1000000000LL;
+	clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL );
+}
+
+static void *isr_thread(void *arg)
+{
+	unsigned long seq;
+	long long due = now_ns();
+	uint8_t port, data[3];
+	int i;
+
+	(void)arg;
+	for(seq = 0; seq < TEST_EVENTS; seq++)
+	{
+		data[0] = TEST_STATUS;
+		data[1] = (seq >> 7) & 0x7F;
+		data[2] = seq & 0x7F;
+		for(i = (seq & 1) ? 1 : 0; i < 3; i++)     // Odd: Running Status
+		{
+			wait_until( &due );
+			for(port = 0; port < MIDI_PORTS; port++)
+			{
+				UART_PutRaw( port, data[i] );      // Never waits
+			}
+			due += BYTE_NS;
+		}
+	}
+	return NULL;
+}
+
+static void *parser_thread(void *arg)
+{
+	(void)arg;
+	while( !bParserStop )
+	{
+		MIDI2USB_Poll();
+		if( nMidiRawHead[0] == nMidiRawTail[0] )
+			sched_yield();                     // Idle, one core hosts
+	}
+	MIDI2USB_Poll();                           // Bytes put before the stop
+	return NULL;
+}
+
+static unsigned long nGot, nGap;
+
+static void *usb_thread(void *arg)
+{
+	unsigned long next[MIDI_PORTS] = { 0 };
+	unsigned long seq;
+	long long stall = now_ns();
+	MIDI_RING_INDEX tail;
+	uint8_t ev[4], port;
+
+	(void)arg;
+	for(;;)
+	{
+		int stop = bUsbStop;                   // Read before the head
+
+		tail = nMidiTail;
+		while( tail != nMidiHead )
+		{
+			ev[0] = aMidiRing[tail & MIDI_RING_MASK][0];
+			ev[1] = aMidiRing[tail & MIDI_RING_MASK][1];
+			ev[2] = aMidiRing[tail & MIDI_RING_MASK][2];
+			ev[3] = aMidiRing[tail & MIDI_RING_MASK][3];
+			tail++;
+
+			for(port = 0; port < MIDI_PORTS; port++)
+			{
+				if( (ev[0] >> 4) == aPortCable[port] )
+					break;
+			}
+			if( port == MIDI_PORTS || (ev[0] & 0x0F) != (TEST_STATUS >> 4) ||
+			    ev[1] != TEST_STATUS )
+			{
+				if( nErrors++ < 10 )
+					printf("bad event %02X %02X %02X %02X\n",
+					       ev[0], ev[1], ev[2], ev[3]);
+				continue;
+			}
+			// 14-bit sequence: the next one with these low bits
+			seq = next[port] + ((((unsigned long)ev[2] << 7 | ev[3]) -
+			                     next[port]) & 0x3FFF);
+			if( seq - next[port] > 0x3FFF - MIDI_RING_SIZE )
+			{
+				if( nErrors++ < 10 )           // Older than the ring holds
+					printf("stale event %02X %02X %02X %02X\n",
+					       ev[0], ev[1], ev[2], ev[3]);
+			}
+			nGap += seq - next[port];          // Dropped (ring full, filter)
+			next[port] = seq + 1;
+			nGot++;
+		}
+		nMidiTail = tail;                      // Release the slots
+
+		if( stop )
+			break;
+		sched_yield();
+		if( now_ns() - stall >= 1000000000LL )
+		{
+			stall += 1000000000LL + TEST_STALL_MS * 1000000LL;
+			wait_until( &stall );              // Host busy: ring fills
+		}
+	}
+
+	for(port = 0; port < MIDI_PORTS; port++)
+	{
+		nGap += TEST_EVENTS - next[port];      // Dropped at the end
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t isr, parser, usb;
+
+	firmware_init();
+	pthread_create( &usb,    NULL, usb_thread,    NULL );
+	pthread_create( &parser, NULL, parser_thread, NULL );
+	pthread_create( &isr,    NULL, isr_thread,    NULL );
+
+	pthread_join( isr, NULL );
+	bParserStop = 1;
+	pthread_join( parser, NULL );
+	while( nMidiHead != nMidiTail )
+		sched_yield();                         // Let usb take the rest
+	bUsbStop = 1;
+	pthread_join( usb, NULL );
+
+	printf("events %lu, lost %lu (ring %u), peak %u, raw lost %u\n", nGot,
+	       nGap, (unsigned)nMidiRingLost, (unsigned)nMidiRingPeak,
+	       (unsigned)nMidiRawLost);
+	if( nGot + nGap != MIDI_PORTS * TEST_EVENTS ||
+	    (uint16_t)nGap != (uint16_t)(nMidiRingLost + TEST_FILTERED) )
+	{
+		printf("events and losses do not add up\n");
+		nErrors++;
+	}
+	nErrors += nMidiRawLost != 0;
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
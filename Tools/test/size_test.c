@@ -0,0 +1,88 @@
+//---------------------------------------------------------------------------//
+// Sizing model of the MIDI->USB event ring: the host stops reading EP1IN    //
+// for 50ms while MIDI IN ports get the worst input at full line rate, one   //
+// event per byte (Program Change under Running Status). As many ports as    //
+// the ring is sized for are busy, no event may be lost. Prints the XRAM     //
+// budget and the stall each number of busy ports may last. Run it with the  //
+// options of the build in question (Makefile variants).                     //
+//---------------------------------------------------------------------------//
+#include <stdio.h>
+
+#include "firmware.h"
+
+#define STALL_MS        50                  // Host stall to ride out
+#define BYTE_US         320                 // 10 bits at 31250 baud
+#define STALL_EVENTS    (STALL_MS*1000/BYTE_US + 1) // Per port
+
+// Next byte of the worst stream on the port
+static void receive(uint8_t port, uint8_t dataByte)
+{
+#if MIDI_SOFT_PORTS
+	if( port >= MIDI_PORT_SOFT0 )
+	{
+		SOFT_Put( port - MIDI_PORT_SOFT0, dataByte );
+		return;
+	}
+#endif
+	UART_PutRaw( port, dataByte );
+}
+
+int main(void)
+{
+	unsigned long bytes = 0, due;
+	unsigned busy, port, ms, events;
+	unsigned nErrors = 0;
+
+	firmware_init();
+
+	printf("XDATA %u of %u bytes, event ring %u slots\n",
+	       (unsigned)XDATA_USED, XRAM_SIZE - XRAM_RESERVED, MIDI_RING_SIZE);
+	for(busy = 1; busy <= MIDI_IN_PORTS; busy++)
+	{
+		printf("  %u busy port(s): %lu ms stall\n", busy,
+		       MIDI_RING_SIZE * (unsigned long)BYTE_US / busy / 1000);
+	}
+
+	busy = MIDI_RING_SIZE / STALL_EVENTS;
+	if( busy > MIDI_IN_PORTS )
+		busy = MIDI_IN_PORTS;
+	if( busy == 0 )
+	{
+		printf("the ring does not hold a %ums stall of one port\n",
+		       STALL_MS);
+		nErrors++;
+	}
+
+	// Stall: nobody takes events from the ring, the parser runs every ms
+	for(ms = 1; ms <= STALL_MS; ms++)
+	{
+		for(due = ms * 1000UL / BYTE_US + 1; bytes < due; bytes++)
+		{
+			for(port = 0; port < busy; port++)
+			{
+				receive( port, bytes ? (uint8_t)(bytes & 0x7F) : 0xC0 );
+			}
+		}
+		nSystemTick++;
+		MIDI2USB_Poll();
+#if MIDI_SOFT_THRU
+		MIDI_Thru();                        // Thru never waits for USB
+		for(port = 0; port < MIDI_PORTS; port++)
+		{
+			while( UART_NextByte( port ) )
+				;
+		}
+#endif
+	}
+
+	events = (MIDI_RING_INDEX)(nMidiHead - nMidiTail);
+	printf("%ums stall, %u busy port(s): %u events queued, lost %u\n",
+	       STALL_MS, busy, events, (unsigned)nMidiRingLost);
+	if( events != busy * (bytes - 1) || nMidiRingLost || nMidiRawLost )
+	{
+		nErrors++;
+	}
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
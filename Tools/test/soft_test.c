@@ -0,0 +1,187 @@
+//---------------------------------------------------------------------------//
+// Software MIDI IN test (MIDI_SOFT_PORTS 3): three lines send random bytes  //
+// at full rate, port 0 at 31250 baud, ports 1 and 2 1% faster and slower,   //
+// with random phase and now and then an idle gap. The edges are simulated   //
+// on the PCA0 counter (128 counts per bit) and go to SOFT_Edge in PCA0_ISR  //
+// order, the stop bit timer (module 4) calls SOFT_Tick when it matches.     //
+// The main loop takes the bytes from the raw rings every ms. All bytes must //
+// arrive in order with no framing error, then a low stop bit must give one  //
+// error and the next byte must be received again.                           //
+//---------------------------------------------------------------------------//
+#include <stdio.h>
+
+#include "firmware.h"
+
+#if MIDI_SOFT_PORTS != 3
+#error "build with -DMIDI_SOFT_PORTS=3"
+#endif
+
+#define BYTES           20000               // Per port
+#define MS_COUNTS       4000UL              // PCA0 counts per ms (4MHz)
+
+typedef struct
+{
+	double   bit;                           // Bit time, PCA0 counts
+	double   t;                             // Line time of the next frame
+	uint8_t  sent[BYTES + 1];
+	unsigned nSent, nGot;
+	unsigned long edge[10 * (BYTES + 1)];   // Edge times, level alternates
+	unsigned nEdge, nNext;
+} LINE;
+
+static LINE     aLine[MIDI_SOFT_PORTS];
+static unsigned long seed = 1;
+static unsigned nErrors;
+
+static unsigned rnd(unsigned n)
+{
+	seed = seed * 1103515245UL + 12345;
+	return (unsigned)(seed >> 16) % n;
+}
+
+// Frame of the byte: start bit, 8 data bits (LSB first), stop bit; the
+// stop bit is low for a break. The line is high before and after.
+static void frame(LINE *l, uint8_t b, bool bBreak)
+{
+	unsigned k;
+	int      level = 1, bitLevel;
+
+	for( k = 0; k < 10; k++ )
+	{
+		bitLevel = k == 0 ? 0 : k == 9 ? !bBreak : (b >> (k - 1)) & 1;
+		if( bitLevel != level )
+		{
+			l->edge[l->nEdge++] = (unsigned long)(l->t + k * l->bit + 0.5);
+			level = bitLevel;
+		}
+	}
+	if( !level )                            // Break: high after 2 bits more
+		l->edge[l->nEdge++] = (unsigned long)(l->t + 11 * l->bit + 0.5);
+	l->t += (bBreak ? 13 : 10) * l->bit;
+	if( !bBreak )
+		l->sent[l->nSent++] = b;
+}
+
+// Bytes the main loop finds in the raw ring of the port
+static void take(uint8_t n)
+{
+	LINE   *l = &aLine[n];
+	uint8_t port = MIDI_PORT_SOFT0 + n, b;
+
+	while( nMidiRawTail[port] != nMidiRawHead[port] )
+	{
+		b = aMidiRaw[port][nMidiRawTail[port] & MIDI_RAW_MASK][0];
+		if( l->nGot >= l->nSent || b != l->sent[l->nGot] )
+		{
+			if( nErrors++ < 10 )
+				printf("  port %u byte %u: %02X\n", n, l->nGot, b);
+		}
+		l->nGot++;
+		nMidiRawTail[port]++;
+	}
+}
+
+// Runs the PCA0 until all edges are taken and the stop bit timer is off
+static void run(void)
+{
+	static unsigned long t;                 // PCA0 counter, not wrapped
+	unsigned long next, match = 0, ms = t / MS_COUNTS;
+	bool    bArmed = false;
+	uint8_t n;
+
+	for(;;)
+	{
+		next = (unsigned long)-1;
+		for( n = 0; n < MIDI_SOFT_PORTS; n++ )
+		{
+			if( aLine[n].nNext < aLine[n].nEdge &&
+			    aLine[n].edge[aLine[n].nNext] < next )
+				next = aLine[n].edge[aLine[n].nNext];
+		}
+		if( bArmed && match < next )
+		{
+			t = match;                      // Compare of module 4
+			PCA0CP4 = (uint16_t)t;
+			SOFT_Tick();
+		}
+		else if( next != (unsigned long)-1 )
+		{
+			t = next;                       // Captures, in ISR order
+			for( n = 0; n < MIDI_SOFT_PORTS; n++ )
+			{
+				if( aLine[n].nNext < aLine[n].nEdge &&
+				    aLine[n].edge[aLine[n].nNext] == t )
+				{
+					aLine[n].nNext++;
+					SOFT_Edge( n, (uint16_t)t );
+				}
+			}
+		}
+		else
+		{
+			break;                          // Lines idle, timer off
+		}
+		// Module 4 matches when the counter next equals its register
+		bArmed = (PCA0CPM4 & PCA0CPM4_ECCF__BMASK) != 0;
+		match  = t + (uint16_t)(((uint16_t)PCA0CPH4 << 8 | PCA0CPL4) -
+		                        (uint16_t)t);
+		if( t / MS_COUNTS != ms )
+		{
+			ms = t / MS_COUNTS;
+			nSystemTick++;
+			for( n = 0; n < MIDI_SOFT_PORTS; n++ )
+				take( n );
+		}
+	}
+	for( n = 0; n < MIDI_SOFT_PORTS; n++ )
+		take( n );
+}
+
+int main(void)
+{
+	static const double rate[MIDI_SOFT_PORTS] = { 1.0, 1.01, 0.99 };
+	unsigned i;
+	uint8_t  n;
+	LINE    *l;
+
+	firmware_init();
+	PCA0_Init();
+
+	for( n = 0; n < MIDI_SOFT_PORTS; n++ )
+	{
+		l = &aLine[n];
+		l->bit = SOFT_BIT / rate[n];
+		l->t   = 100 + rnd( SOFT_BIT * 10 );
+		for( i = 0; i < BYTES; i++ )
+		{
+			if( rnd( 16 ) == 0 )
+				l->t += rnd( 4 * SOFT_BIT );    // Idle line
+			frame( l, rnd( 256 ), false );
+		}
+	}
+	run();
+	for( n = 0; n < MIDI_SOFT_PORTS; n++ )
+	{
+		l = &aLine[n];
+		printf("port %u: %u of %u bytes\n", n, l->nGot, l->nSent);
+		if( l->nGot != l->nSent )
+			nErrors++;
+	}
+	printf("framing errors %u\n", (unsigned)nSoftRxErrors);
+	if( nSoftRxErrors )
+		nErrors++;
+
+	// Break on port 0: one error, the next byte is fine again
+	l = &aLine[0];
+	l->t = l->edge[l->nEdge - 1] + 20 * l->bit;
+	frame( l, 0x00, true );
+	frame( l, 0x55, false );
+	run();
+	printf("break: %u error(s), %u of %u bytes\n", (unsigned)nSoftRxErrors,
+	       l->nGot, l->nSent);
+	if( nSoftRxErrors != 1 || l->nGot != l->nSent )
+		nErrors++;
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+//---------------------------------------------------------------------------//
+// Status byte table test: walks aStatusInfo[0..255] and checks each entry   //
+// against the MIDI 1.0 and USB-MIDI 1.0 specs, written out here on their    //
+// own: the data bytes that follow the status byte (MIDI 1.0 Table I, II and //
+// III), the Code Index Number of its USB-MIDI event (midi10 Table 4-1), the //
+// Real-Time and SysEx flags. Data bytes (00-7F) and F4/F5 must be 0.        //
+//---------------------------------------------------------------------------//
+#include <stdio.h>
+
+#include "firmware.h"
+
+typedef struct
+{
+	int      len;                           // Data bytes, -1 = none defined
+	uint8_t  cin;                           // USB-MIDI Code Index Number
+	bool     bRT, bSysEx;
+	const char *name;
+} SPEC;
+
+static SPEC spec(unsigned b)
+{
+	SPEC s = { -1, 0, false, false, "data byte" };
+
+	if( b < 0x80 )
+		return s;
+	if( b < 0xF0 )                          // Channel Voice messages
+	{
+		static const char *names[] = { "Note Off", "Note On",
+		    "Poly Key Pressure", "Control Change", "Program Change",
+		    "Channel Pressure", "Pitch Bend" };
+		s.name = names[(b >> 4) - 8];
+		s.len  = (b & 0xE0) == 0xC0 ? 1 : 2;
+		s.cin  = b >> 4;                    // CIN 0x8-0xE
+		return s;
+	}
+	switch( b )
+	{
+		case 0xF0: s.name = "SysEx start"; s.bSysEx = true; s.cin = 0x4; break;
+		case 0xF1: s.name = "MTC Quarter Frame"; s.len = 1; s.cin = 0x2; break;
+		case 0xF2: s.name = "Song Position"; s.len = 2; s.cin = 0x3; break;
+		case 0xF3: s.name = "Song Select"; s.len = 1; s.cin = 0x2; break;
+		case 0xF4:
+		case 0xF5: s.name = "undefined"; break;
+		case 0xF6: s.name = "Tune Request"; s.len = 0; s.cin = 0x5; break;
+		case 0xF7: s.name = "SysEx end"; s.bSysEx = true; s.cin = 0x5; break;
+		default:   s.name = "Real-Time"; s.bRT = true; s.cin = 0xF; break;
+	}
+	return s;
+}
+
+int main(void)
+{
+	unsigned b, nErrors = 0;
+	uint8_t  info, want;
+	SPEC     s;
+
+	for( b = 0; b < 256; b++ )
+	{
+		s    = spec( b );
+		want = s.cin | (s.len == 1 ? MIDI_ST_LEN1 : 0) |
+		       (s.len == 2 ? MIDI_ST_LEN2 : 0) |
+		       (s.bRT ? MIDI_ST_RT : 0) | (s.bSysEx ? MIDI_ST_SYSEX : 0);
+		info = aStatusInfo[b];
+		if( info != want )
+		{
+			printf("  %02X %s: %02X (CIN %X, %u data bytes%s%s), want %02X\n",
+			       b, s.name, info, info & MIDI_ST_CIN,
+			       (info & MIDI_ST_LEN) >> 4, info & MIDI_ST_RT ? ", RT" : "",
+			       info & MIDI_ST_SYSEX ? ", SysEx" : "", want);
+			nErrors++;
+		}
+	}
+	printf("256 status bytes, %u wrong\n", nErrors);
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
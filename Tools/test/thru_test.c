@@ -0,0 +1,207 @@
+//---------------------------------------------------------------------------//
+// Soft-thru test (MIDI_SOFT_THRU 1): MIDI IN port 0 gets Note On messages   //
+// at a given rate, one byte per byte time (320us), the main loop runs every //
+// byte time and the UART sends one byte per byte time. The wire of port 0   //
+// is decoded and each thru message is matched with its IN time. Checks      //
+// that thru goes on while the host never reads the event ring, merges with  //
+// host traffic without loss, and that no thru message is late by more than  //
+// MIDI_THRU_LATENCY byte times (it is dropped instead) under a host burst.  //
+//---------------------------------------------------------------------------//
+#include <stdio.h>
+
+#include "firmware.h"
+
+#if !MIDI_SOFT_THRU
+#error "build with -DMIDI_SOFT_THRU=1"
+#endif
+
+#define BYTE_US         320                 // 10 bits at 31250 baud
+#define IN_MAX          4096                // Thru messages per run
+#define LATENCY_MAX     (MIDI_THRU_LATENCY + 3 + 1) // Own bytes, rounding
+
+static unsigned long now;                   // Byte times
+static unsigned long aInTime[IN_MAX];       // Last IN byte of message
+static unsigned nInSent, nInNext, nThruGot;
+static unsigned nHostWait, nHostSent, nHostGot;
+static unsigned nClockSent, nClockGot;
+static unsigned long maxLatency;
+static uint8_t  outStatus, outData[2], outCount;
+static unsigned nErrors;
+
+// Thru message of sequence number: Note On, the number in note and velocity
+static uint8_t seqNote(unsigned seq)
+{
+	return seq & 0x7F;
+}
+
+static uint8_t seqVelocity(unsigned seq)
+{
+	return 1 + (seq >> 7) % 127;
+}
+
+// Decodes the byte the UART sends now (running status is taken)
+static void wire(uint8_t b)
+{
+	unsigned seq;
+
+	if( b >= 0xF8 )
+	{
+		nClockGot += b == 0xF8;
+		return;
+	}
+	if( b & 0x80 )
+	{
+		outStatus = b;
+		outCount  = 0;
+		return;
+	}
+	outData[outCount++] = b;
+	if( outCount < 2 )
+		return;
+	outCount = 0;
+
+	if( outStatus == 0x91 && outData[0] == (nHostGot & 0x7F) &&
+	    outData[1] == 0x40 )
+	{
+		nHostGot++;                         // Host messages in order
+		return;
+	}
+	for( seq = nInNext; seq < nInSent; seq++ )
+	{
+		if( outData[0] == seqNote( seq ) && outData[1] == seqVelocity( seq ) )
+			break;                          // Later ones may be dropped
+	}
+	if( outStatus != 0x90 || seq == nInSent )
+	{
+		printf("  %lu: unexpected %02X %02X %02X\n", now, outStatus,
+		       outData[0], outData[1]);
+		nErrors++;
+		return;
+	}
+	if( now - aInTime[seq] > maxLatency )
+		maxLatency = now - aInTime[seq];
+	nInNext = seq + 1;
+	nThruGot++;
+}
+
+// One byte time: IN byte (or idle line), main loop, the UART sends a byte
+static void step(int inByte)
+{
+	SI_SEG_XDATA uint8_t ev[4];
+
+	if( inByte >= 0 )
+		UART_PutRaw( 0, (uint8_t)inByte );
+	if( now * BYTE_US / 1000 != (now + 1) * BYTE_US / 1000 )
+		nSystemTick++;
+
+	MIDI2USB_Poll();
+	MIDI_Thru();
+	while( nHostWait )                      // Host events, as USB2MIDI does
+	{
+		ev[0] = 0x09;                       // Same lane as thru notes
+		ev[1] = 0x91;
+		ev[2] = nHostSent & 0x7F;
+		ev[3] = 0x40;
+		if( !MIDI_Output( 0, MIDI_SRC_USB, ev ) )
+			break;                          // Lane full: next time
+		nHostSent++;
+		nHostWait--;
+	}
+
+	if( UART_NextByte( 0 ) )
+		wire( txByte );
+	now++;
+}
+
+// Next Note On on MIDI IN port 0, three byte times
+static void noteIn(void)
+{
+	step( 0x90 );
+	step( seqNote( nInSent ) );
+	aInTime[nInSent] = now;
+	step( seqVelocity( nInSent ) );
+	nInSent++;
+}
+
+static void start(void)
+{
+	nInSent = nInNext = nThruGot = 0;
+	nHostSent = nHostGot = 0;
+	nClockSent = nClockGot = 0;
+	maxLatency = 0;
+}
+
+// Lets the wire run dry, then checks the counts of the run
+static void finish(const char *name, unsigned thruDropped, bool bDrops)
+{
+	unsigned i;
+
+	for( i = 0; i < 256; i++ )
+		step( -1 );
+	thruDropped = nThruDropped - thruDropped;
+
+	printf("%s: thru %u of %u (dropped %u), host %u of %u, clock %u of %u, "
+	       "latency %lu byte times\n", name, nThruGot, nInSent, thruDropped,
+	       nHostGot, nHostSent, nClockGot, nClockSent, maxLatency);
+	if( nThruGot + thruDropped != nInSent || (thruDropped != 0) != bDrops ||
+	    nHostGot != nHostSent || nHostWait || nClockGot != nClockSent ||
+	    maxLatency > LATENCY_MAX )
+	{
+		printf("%s: FAIL\n", name);
+		nErrors++;
+	}
+}
+
+int main(void)
+{
+	unsigned k, i, dropped;
+
+	firmware_init();
+
+	// Full line rate, the host never reads: thru must not stop
+	start();
+	dropped = nThruDropped;
+	while( nInSent < IN_MAX )
+		noteIn();
+	finish( "no host", dropped, false );
+	if( nMidiRingLost != IN_MAX - MIDI_RING_SIZE ||
+	    (MIDI_RING_INDEX)(nMidiHead - nMidiTail) != MIDI_RING_SIZE )
+	{
+		printf("no host: USB side lost %u, %u queued: FAIL\n",
+		       (unsigned)nMidiRingLost,
+		       (unsigned)(MIDI_RING_INDEX)(nMidiHead - nMidiTail));
+		nErrors++;
+	}
+
+	// Merge: IN and host messages every 8 byte times, a Clock every 24
+	start();
+	dropped = nThruDropped;
+	for( k = 0; nInSent < IN_MAX; k++ )
+	{
+		noteIn();
+		nHostWait++;
+		step( -1 );
+		step( -1 );
+		step( k % 3 ? -1 : 0xF8 );
+		nClockSent += k % 3 == 0;
+		step( -1 );
+		step( -1 );
+	}
+	finish( "merge", dropped, false );
+
+	// Host bursts fill the Note lane: thru is dropped rather than delayed
+	start();
+	dropped = nThruDropped;
+	for( k = 0; nInSent < IN_MAX; k++ )
+	{
+		if( k % 32 == 0 )
+			nHostWait += 40;
+		noteIn();
+		for( i = 0; i < 5; i++ )
+			step( -1 );
+	}
+	finish( "host burst", dropped, true );
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
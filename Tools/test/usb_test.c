@@ -0,0 +1,351 @@
+//---------------------------------------------------------------------------//
+// USB timing test: the main loop stages (MIDI2USB_Poll, EP1IN_Send,         //
+// EP2OUT_Take) run every 20us, SOF and Timer2 come every ms, the UARTs      //
+// receive one byte per 320us. The host takes every EP1IN packet as soon as  //
+// it is written (EP1IN is double buffered). Measures, per input pattern,    //
+// IN packets per second, events per packet and the latency from the last    //
+// MIDI byte of an event to its IN packet. Checks the flush policy bounds:   //
+// a Note-On on an idle bus goes out at once, other events within            //
+// MIDI_FLUSH_FRAMES frames, at most one packet per frame, no event lost.    //
+// Aggregate run: both MIDI IN ports and both MIDI OUT ports at once at full //
+// rate, the host sends an EP2OUT packet whenever a read is pending. All     //
+// four lines must carry their line rate with no event lost.                 //
+// USB stall: the host NAKs EP1IN for 50ms while both MIDI IN ports send one //
+// event per byte (Channel Pressure, Running Status). The event ring must    //
+// hold it all, the backlog then goes out at up to 19 packets per frame.     //
+//---------------------------------------------------------------------------//
+#include <stdio.h>
+#include <string.h>
+
+#include "firmware.h"
+
+#define STEP_US         20                  // Main loop pass
+#define BYTE_US         320                 // 10 bits at 31250 baud
+#define FRAME_US        1000                // USB frame, Timer2 tick
+#define SEQ_MAX         16000               // Events per port and run
+#define WIRE_MIN        0.99                // Busy share of a MIDI OUT line
+#define BULK_MAX        19                  // 64-byte bulk packets per frame
+#define STALL_US        50000               // Host does not read EP1IN
+
+typedef struct
+{
+	uint8_t  status;                        // 0x9n, 0xBn, 0xDn, 0 = silent
+	bool     bRunning;                      // Running Status on the wire
+	unsigned gapUs;                         // Idle line after each message
+	unsigned count;                         // Messages to send
+	unsigned seq, got;                      // Sent, received by the host
+	unsigned long due;                      // Time of the next byte
+	uint8_t  msg[3], pos, len;
+	unsigned long arrival[SEQ_MAX];         // Last byte of message, us
+} SOURCE;
+
+// Host events for a MIDI OUT port and the wire they come out of
+typedef struct
+{
+	uint8_t  status;                        // 0x9n, 0 = silent
+	unsigned count;                         // Events to send
+	unsigned seq, got;                      // Sent, decoded on the wire
+	unsigned long due;                      // UART sends the next byte
+	unsigned long first, last, bytes;       // Wire busy time and bytes
+	uint8_t  wire, data[2], nData;          // Decoder, Running Status
+} SINK;
+
+static SOURCE   aSource[MIDI_PORTS];
+static SINK     aSink[MIDI_PORTS];
+static unsigned long nOutPackets;
+static unsigned nFrameOut, maxFrameOut;
+static unsigned long now;                   // us
+static unsigned long stallAt, stallUs;      // EP1IN NAKed, from run start
+static unsigned long nPackets, nEvents, nFrames;
+static unsigned long sumLatency, maxLatency;
+static unsigned nFramePackets, maxFramePackets;
+static unsigned nErrors;
+
+// Host: an IN packet has been loaded into EP1IN, check and time its events
+static void host_in(const uint8_t *dat, uint16_t n)
+{
+	SOURCE  *s;
+	unsigned seq, i;
+	uint8_t  port;
+
+	nPackets++;
+	nFramePackets++;
+	for( i = 0; i + 4 <= n; i += 4 )
+	{
+		for( port = 0; port < MIDI_PORTS; port++ )
+		{
+			if( aPortCable[port] == dat[i] >> 4 )
+				break;
+		}
+		s   = &aSource[port < MIDI_PORTS ? port : 0];
+		seq = s->got;                       // Pressure: low 7 bits only
+		if( port == MIDI_PORTS || dat[i + 1] != s->status ||
+		    dat[i + 2] != (seq & 0x7F) || seq >= s->seq ||
+		    dat[i + 3] != ((s->status & 0xE0) == 0xC0 ? 0 : 1 + (seq >> 7)) )
+		{
+			if( nErrors++ < 10 )
+				printf("  %lu: event %02X %02X %02X %02X, want seq %u\n",
+				       now, dat[i], dat[i + 1], dat[i + 2], dat[i + 3],
+				       s->got);
+			continue;
+		}
+		s->got++;
+		nEvents++;
+		sumLatency += now - s->arrival[seq];
+		if( now - s->arrival[seq] > maxLatency )
+			maxLatency = now - s->arrival[seq];
+	}
+}
+
+// MIDI IN line of the port: the byte due now, the message number is in the
+// data bytes (note/controller and value)
+static void line(uint8_t port)
+{
+	SOURCE *s = &aSource[port];
+
+	if( !s->status || now < s->due )
+		return;
+	if( s->pos == s->len )
+	{
+		if( s->seq == s->count )
+			return;                         // Done, line idle
+		s->len = 0;
+		if( !s->bRunning || s->seq == 0 )
+			s->msg[s->len++] = s->status;
+		s->msg[s->len++] = s->seq & 0x7F;
+		if( (s->status & 0xE0) != 0xC0 )
+			s->msg[s->len++] = 1 + (s->seq >> 7);
+		s->pos = 0;
+	}
+	UART_PutRaw( port, s->msg[s->pos++] );  // Stop bit is in now
+	s->due += BYTE_US;
+	if( s->pos == s->len )
+	{
+		s->arrival[s->seq++] = now;
+		s->due += s->gapUs;
+	}
+}
+
+// Host: puts the next EP2OUT packet, events for both ports in turn
+static void host_out(void)
+{
+	SINK    *k;
+	unsigned n = 0;
+	uint8_t  port, cable, more = 1;
+
+	if( !bEpOutRead )
+		return;                             // NAKed, the FIFO is full
+	while( more && n < USB_BUF_SIZE )
+	{
+		more = 0;
+		for( port = 0; port < MIDI_PORTS && n < USB_BUF_SIZE; port++ )
+		{
+			k = &aSink[port];
+			if( !k->status || k->seq == k->count )
+				continue;
+			for( cable = 0; aCableRoute[cable] != port; cable++ )
+				;
+			aUsbBuffer[n++] = cable << 4 | k->status >> 4;
+			aUsbBuffer[n++] = k->status;
+			aUsbBuffer[n++] = k->seq & 0x7F;
+			aUsbBuffer[n++] = 1 + (k->seq >> 7);
+			k->seq++;
+			more = 1;
+		}
+	}
+	if( n )
+	{
+		bEpOutRead = false;
+		USBD_XferCompleteCb( EP2OUT, USB_STATUS_OK, n, 0 );
+		nOutPackets++;
+		nFrameOut++;
+	}
+}
+
+// UART of MIDI OUT port: sends the next byte when the last one is out,
+// decodes the wire and checks the events are in order
+static void uart_tx(uint8_t port)
+{
+	SINK    *k = &aSink[port];
+	unsigned seq;
+
+	if( now < k->due || !UART_NextByte( port ) )
+		return;
+	if( !k->bytes++ )
+		k->first = now;
+	k->last = now;
+	k->due  = now + BYTE_US;
+	if( txByte & 0x80 )
+	{
+		k->wire  = txByte;
+		k->nData = 0;
+		return;
+	}
+	k->data[k->nData++] = txByte;
+	if( k->nData < 2 )
+		return;
+	k->nData = 0;
+	seq = k->data[0] | (unsigned)(k->data[1] - 1) << 7;
+	if( k->wire != k->status || seq != k->got )
+	{
+		if( nErrors++ < 10 )
+			printf("  %lu: port %u sent %02X %02X %02X, want seq %u\n",
+			       now, port, k->wire, k->data[0], k->data[1], k->got);
+	}
+	k->got++;
+}
+
+// Runs until all sources are sent and taken, plus a few idle frames
+static void run(const char *name, unsigned long maxUs, unsigned maxPerFrame)
+{
+	unsigned long start = now, idle = 0, sent = 0, out = 0;
+	uint8_t  port;
+	bool     bBusy;
+
+	nPackets = nEvents = nFrames = nOutPackets = 0;
+	sumLatency = maxLatency = 0;
+	maxFramePackets = maxFrameOut = 0;
+	nMidiRingPeak = 0;
+	for( port = 0; port < MIDI_PORTS; port++ )
+	{
+		aSource[port].due = now;
+		sent += aSource[port].count;
+		out  += aSink[port].count;
+	}
+
+	while( idle < 5 * FRAME_US )
+	{
+		if( now % FRAME_US == 0 )
+		{
+			Timer2_ISR();                   // 1ms tick
+			USBD_SofCb( 0 );                // Start of frame
+			if( nFramePackets > maxFramePackets )
+				maxFramePackets = nFramePackets;
+			if( nFrameOut > maxFrameOut )
+				maxFrameOut = nFrameOut;
+			nFramePackets = 0;
+			nFrameOut = 0;
+			nFrames++;
+		}
+		for( port = 0; port < MIDI_PORTS; port++ )
+			line( port );
+		host_out();
+		bEpInBusy = (now - start >= stallAt && now - start < stallAt + stallUs)
+		            || nFramePackets >= BULK_MAX;   // Bus time is used up
+
+		MIDI2USB_Poll();                    // The main loop
+		EP1IN_Send();
+		EP2OUT_Take();
+
+		for( port = 0; port < MIDI_PORTS; port++ )
+			uart_tx( port );
+		now += STEP_US;
+		bBusy = nMidiHead != nMidiTail || nMidiRTHead != nMidiRTTail;
+		for( port = 0; port < MIDI_PORTS; port++ )
+		{
+			bBusy |= aSource[port].seq != aSource[port].count ||
+			         aSink[port].seq != aSink[port].count ||
+			         bUartBusy[port];
+		}
+		idle = bBusy ? 0 : idle + STEP_US;  // Lost events end it too
+	}
+
+	printf("%-18s %6lu events %5.0f packets/s %5.2f events/packet "
+	       "latency %4lu/%4lu us\n", name, nEvents,
+	       nPackets * 1e6 / (now - start), (double)nEvents / nPackets,
+	       sumLatency / nEvents, maxLatency);
+	if( stallUs )
+		printf("%-18s %6u events in the ring at most, %u packets per "
+		       "frame\n", "", (unsigned)nMidiRingPeak, maxFramePackets);
+	if( nEvents != sent || maxLatency > maxUs ||
+	    maxFramePackets > maxPerFrame ||
+	    nMidiRingLost || nMidiRawLost || nMidiRTDropped )
+	{
+		printf("%s: FAIL (at most %lu us, %u packets per frame, "
+		       "%u were sent)\n", name, maxUs, maxPerFrame, maxFramePackets);
+		nErrors++;
+	}
+	if( out )
+		printf("%-18s %6lu EP2OUT packets, at most %u per frame\n", "",
+		       nOutPackets, maxFrameOut);
+	for( port = 0; port < MIDI_PORTS && out; port++ )
+	{
+		SINK  *k = &aSink[port];
+		double busy = k->bytes * (double)BYTE_US /
+		              (k->last - k->first + BYTE_US);
+
+		printf("%-18s %6u events on MIDI OUT %u, wire busy %5.1f%%\n", "",
+		       k->got, port, busy * 100);
+		if( k->got != k->count || busy < WIRE_MIN )
+		{
+			printf("%s: FAIL (MIDI OUT %u)\n", name, port);
+			nErrors++;
+		}
+	}
+	memset( aSource, 0, sizeof(aSource) );
+	memset( aSink, 0, sizeof(aSink) );
+	stallAt = stallUs = 0;
+}
+
+int main(void)
+{
+	firmware_init();
+	pEpInWrite = host_in;
+	USBD_DeviceStateChangeCb( USBD_STATE_ADDRESSED, USBD_STATE_CONFIGURED );
+
+	// Note-On now and then: sent at once, one per packet
+	aSource[0].status = 0x90;
+	aSource[0].count  = 1000;
+	aSource[0].gapUs  = 4300;               // Not in step with the frames
+	run( "sparse Note-On",
+	     MIDI_FLUSH_URGENT ? STEP_US : MIDI_FLUSH_FRAMES * FRAME_US, 1 );
+
+	// Control Change now and then: waits for the frame boundary
+	aSource[0].status = 0xB0;
+	aSource[0].count  = 1000;
+	aSource[0].gapUs  = 4300;
+	run( "sparse CC", MIDI_FLUSH_FRAMES * FRAME_US, 1 );
+
+	// Both ports at full rate, Note-On under Running Status
+	aSource[0].status   = 0x90;
+	aSource[0].bRunning = true;
+	aSource[0].count    = SEQ_MAX;
+	aSource[1].status   = 0x91;
+	aSource[1].bRunning = true;
+	aSource[1].count    = SEQ_MAX;
+	run( "full rate Note-On", MIDI_FLUSH_FRAMES * FRAME_US, 1 );
+
+	// Both ports at full rate, three byte Control Changes
+	aSource[0].status = 0xB0;
+	aSource[0].count  = SEQ_MAX;
+	aSource[1].status = 0xB1;
+	aSource[1].count  = SEQ_MAX;
+	run( "full rate CC", MIDI_FLUSH_FRAMES * FRAME_US, 1 );
+
+	// Aggregate: both IN and both OUT lines at full rate at once
+	aSource[0].status   = 0x90;
+	aSource[0].bRunning = true;
+	aSource[0].count    = SEQ_MAX;
+	aSource[1].status   = 0x91;
+	aSource[1].bRunning = true;
+	aSource[1].count    = SEQ_MAX;
+	aSink[0].status     = 0x92;
+	aSink[0].count      = SEQ_MAX;
+	aSink[1].status     = 0x93;
+	aSink[1].count      = SEQ_MAX;
+	run( "aggregate", MIDI_FLUSH_FRAMES * FRAME_US, 1 );
+
+	// Host stall at one event per byte on both ports: nothing is lost
+	aSource[0].status   = 0xD0;
+	aSource[0].bRunning = true;
+	aSource[0].count    = SEQ_MAX;
+	aSource[1].status   = 0xD1;
+	aSource[1].bRunning = true;
+	aSource[1].count    = SEQ_MAX;
+	stallAt = 1000000;
+	stallUs = STALL_US;
+	run( "USB stall 50ms", STALL_US + MIDI_FLUSH_FRAMES * FRAME_US, BULK_MAX );
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+//---------------------------------------------------------------------------//
+// Output path test: USB-MIDI events go in through MIDI_Output (as from the  //
+// host), the bytes come out of UART_NextByte as the UART ISR sends them.    //
+// Checks the wire bytes of mixed Voice, Real-Time, System Common and SysEx  //
+// streams, that running status is used and that SysEx and System Common     //
+// cancel it, the end of a stalled SysEx and the RT delay histogram.         //
+// Variants: the histogram is checked with MIDI_RT_JITTER 1 (-jitter), the   //
+// plain encoder with MIDI_RUNNING_STATUS 0 (-norunning), which values are   //
+// merged and which are not with MIDI_TX_COALESCE 1 (-coal). Expects no      //
+// transforms.                                                               //
+//---------------------------------------------------------------------------//
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "firmware.h"
+
+// A status byte that running status leaves out (list of expect())
+#if MIDI_RUNNING_STATUS
+#define RS(status)
+#else
+#define RS(status)      status,
+#endif
+
+static unsigned nErrors;
+static uint8_t  aWire[256];
+static unsigned nWire;
+
+// Queues one event from the host, cable = port
+static void put(uint8_t port, uint8_t cin, uint8_t b1, uint8_t b2, uint8_t b3)
+{
+	SI_SEG_XDATA uint8_t ev[4];
+
+	ev[0] = cin;
+	ev[1] = b1;
+	ev[2] = b2;
+	ev[3] = b3;
+	if( !MIDI_Output( port, MIDI_SRC_USB, ev ) )
+	{
+		printf("  event %X %02X %02X %02X refused\n", cin, b1, b2, b3);
+		nErrors++;
+	}
+}
+
+// Takes up to n bytes off the wire (0: until the port is idle)
+static void send(uint8_t port, unsigned n)
+{
+	do
+	{
+		if( !UART_NextByte( port ) )
+			break;
+		aWire[nWire++] = txByte;
+	} while( --n );
+}
+
+// Compares the wire bytes so far with the list (ends with -1)
+static void expect(const char *name, ...)
+{
+	uint8_t  want[256];
+	unsigned n = 0, i;
+	int      b;
+	va_list  ap;
+
+	va_start( ap, name );
+	while( (b = va_arg( ap, int )) >= 0 )
+		want[n++] = (uint8_t)b;
+	va_end( ap );
+
+	if( n != nWire || memcmp( want, aWire, n ) )
+	{
+		printf("%s: FAIL\n  want", name);
+		for(i = 0; i < n; i++)
+			printf(" %02X", want[i]);
+		printf("\n  got ");
+		for(i = 0; i < nWire; i++)
+			printf(" %02X", aWire[i]);
+		printf("\n");
+		nErrors++;
+	}
+	else
+	{
+		printf("%s: ok\n", name);
+	}
+	nWire = 0;
+}
+
+// Time goes by: the last status is stale afterwards
+static void later(uint16_t ms)
+{
+	nSystemTick += ms;
+}
+
+int main(void)
+{
+	uint8_t port;
+
+	firmware_init();
+	for(port = 0; port < MIDI_PORTS; port++)
+	{
+		printf("-- port %u\n", port);
+
+		later( MIDI_RS_REFRESH );
+		put( port, 0x9, 0x90, 0x3C, 0x64 );
+		put( port, 0x9, 0x90, 0x3E, 0x64 );
+		put( port, 0x8, 0x80, 0x3C, 0x00 );
+		put( port, 0x8, 0x80, 0x3E, 0x00 );
+		send( port, 0 );
+		expect( "running status", 0x90, 0x3C, 0x64, RS(0x90) 0x3E, 0x64,
+		        0x80, 0x3C, 0x00, RS(0x80) 0x3E, 0x00, -1 );
+
+		later( MIDI_RS_REFRESH );
+		put( port, 0xB, 0xB0, 0x07, 0x7F );
+		put( port, 0x9, 0x90, 0x3C, 0x64 );
+		put( port, 0xB, 0xB0, 0x07, 0x40 );
+		put( port, 0xC, 0xC0, 0x05, 0x00 );
+		put( port, 0xE, 0xE0, 0x00, 0x40 );
+		send( port, 0 );
+#if MIDI_TX_COALESCE
+		expect( "notes first", 0x90, 0x3C, 0x64, 0xB0, 0x07, 0x40,
+		        0xC0, 0x05, 0xE0, 0x00, 0x40, -1 );
+#else
+		expect( "notes first", 0x90, 0x3C, 0x64, 0xB0, 0x07, 0x7F,
+		        RS(0xB0) 0x07, 0x40, 0xC0, 0x05, 0xE0, 0x00, 0x40, -1 );
+#endif
+
+		put( port, 0xE, 0xE0, 0x10, 0x40 );
+		send( port, 0 );
+		later( MIDI_RS_REFRESH );
+		put( port, 0xE, 0xE0, 0x20, 0x40 );
+		send( port, 0 );
+		expect( "status refresh", RS(0xE0) 0x10, 0x40, 0xE0, 0x20, 0x40, -1 );
+
+		put( port, 0x9, 0x90, 0x40, 0x64 );
+		send( port, 0 );
+		put( port, 0x4, 0xF0, 0x7E, 0x7F );
+		put( port, 0x7, 0x09, 0x01, 0xF7 );
+		send( port, 0 );
+		put( port, 0x9, 0x90, 0x40, 0x00 );
+		send( port, 0 );
+		expect( "SysEx cancels", 0x90, 0x40, 0x64, 0xF0, 0x7E, 0x7F,
+		        0x09, 0x01, 0xF7, 0x90, 0x40, 0x00, -1 );
+
+		put( port, 0x9, 0x90, 0x41, 0x64 );
+		send( port, 0 );
+		put( port, 0x2, 0xF3, 0x01, 0x00 );      // Song Select
+		send( port, 0 );
+		put( port, 0x9, 0x90, 0x41, 0x00 );
+		send( port, 0 );
+		put( port, 0x5, 0xF6, 0x00, 0x00 );      // Tune Request
+		send( port, 0 );
+		put( port, 0x9, 0x90, 0x42, 0x64 );
+		send( port, 0 );
+		put( port, 0xB, 0xB0, 0x40, 0x7F );
+		put( port, 0x3, 0xF2, 0x10, 0x02 );      // Song Position
+		put( port, 0x2, 0xF1, 0x21, 0x00 );      // MTC Quarter Frame
+		put( port, 0xB, 0xB0, 0x40, 0x00 );      // Voice lane, in order
+		send( port, 0 );
+		expect( "System Common cancels", RS(0x90) 0x41, 0x64, 0xF3, 0x01,
+		        0x90, 0x41, 0x00, 0xF6, 0x90, 0x42, 0x64, 0xB0, 0x40, 0x7F,
+		        0xF2, 0x10, 0x02, 0xF1, 0x21, 0xB0, 0x40, 0x00, -1 );
+
+		put( port, 0x9, 0x90, 0x43, 0x64 );
+		send( port, 1 );
+		put( port, 0xF, 0xF8, 0x00, 0x00 );      // Clock
+		send( port, 0 );
+		put( port, 0x9, 0x90, 0x43, 0x00 );
+		send( port, 2 );
+		put( port, 0xF, 0xFA, 0x00, 0x00 );      // Start
+		put( port, 0xF, 0xF8, 0x00, 0x00 );
+		send( port, 0 );
+#if MIDI_RUNNING_STATUS
+		expect( "Real-Time keeps status", 0x90, 0xF8, 0x43, 0x64, 0x43,
+		        0x00, 0xFA, 0xF8, -1 );
+#else
+		expect( "Real-Time between bytes", 0x90, 0xF8, 0x43, 0x64, 0x90,
+		        0x43, 0xFA, 0xF8, 0x00, -1 );
+#endif
+
+		put( port, 0x4, 0xF0, 0x01, 0x02 );
+		send( port, 0 );
+		put( port, 0xF, 0xFE, 0x00, 0x00 );      // Active Sense
+		put( port, 0x9, 0x90, 0x44, 0x64 );      // Waits for the F7
+		put( port, 0x6, 0x03, 0xF7, 0x00 );
+		send( port, 0 );
+		expect( "SysEx holds the wire", 0xF0, 0x01, 0x02, 0xFE, 0x03,
+		        0xF7, 0x90, 0x44, 0x64, -1 );
+
+		put( port, 0x9, 0x90, 0x45, 0x64 );
+		put( port, 0x4, 0xF0, 0x01, 0x02 );
+		send( port, 0 );
+		put( port, 0x9, 0x90, 0x45, 0x00 );      // Waits for the SysEx
+		send( port, 0 );
+		later( MIDI_TX_SYSEX_HOLD );
+		send( port, 0 );
+		put( port, 0x4, 0x03, 0x04, 0x05 );      // Late data: dropped
+		put( port, 0x7, 0x06, 0x07, 0xF7 );
+		put( port, 0xF, 0xF8, 0x00, 0x00 );
+		put( port, 0x9, 0x90, 0x46, 0x64 );
+		send( port, 0 );
+		expect( "stalled SysEx ends", RS(0x90) 0x45, 0x64, 0xF0, 0x01,
+		        0x02, 0xF7, 0x90, 0x45, 0x00, 0xF8, RS(0x90) 0x46, 0x64, -1 );
+
+		put( port, 0x4, 0xF0, 0x01, 0x02 );
+		send( port, 0 );
+		later( MIDI_TX_SYSEX_HOLD );
+		send( port, 0 );
+		put( port, 0x4, 0xF0, 0x11, 0x12 );      // Host takes over
+		put( port, 0x5, 0xF7, 0x00, 0x00 );
+		send( port, 0 );
+		expect( "new SysEx after stall", 0xF0, 0x01, 0x02, 0xF7,
+		        0xF0, 0x11, 0x12, 0xF7, -1 );
+
+#if MIDI_TX_COALESCE
+		nTxCoalesced = 0;
+		put( port, 0xB, 0xB0, 0x07, 0x10 );      // Volume
+		put( port, 0xE, 0xE0, 0x00, 0x40 );
+		put( port, 0xB, 0xB0, 0x07, 0x20 );      // Replaces 0x10
+		put( port, 0xB, 0xB0, 0x40, 0x7F );      // Sustain: never merged
+		put( port, 0xD, 0xD0, 0x10, 0x00 );
+		put( port, 0xE, 0xE0, 0x7F, 0x7F );      // Replaces 00 40
+		put( port, 0xB, 0xB0, 0x40, 0x00 );
+		put( port, 0xD, 0xD0, 0x20, 0x00 );      // Replaces 0x10
+		send( port, 0 );
+		expect( "latest value wins", 0xB0, 0x07, 0x20, 0xE0, 0x7F, 0x7F,
+		        0xB0, 0x40, 0x7F, 0xD0, 0x20, 0xB0, 0x40, 0x00, -1 );
+		if( nTxCoalesced != 3 )
+		{
+			printf("  %u values merged, want 3\n", nTxCoalesced);
+			nErrors++;
+		}
+#endif
+	}
+
+	later( MIDI_RS_REFRESH );
+	put( 0, 0x9, 0x90, 0x30, 0x64 );
+	put( 1, 0x9, 0x90, 0x31, 0x64 );
+	send( 0, 0 );
+	send( 1, 0 );
+	put( 0, 0x9, 0x90, 0x30, 0x00 );
+	put( 1, 0xB, 0xB0, 0x01, 0x00 );
+	send( 0, 0 );
+	send( 1, 0 );
+	expect( "ports apart", 0x90, 0x30, 0x64, 0x90, 0x31, 0x64,
+	        RS(0x90) 0x30, 0x00, 0xB0, 0x01, 0x00, -1 );
+
+#if MIDI_RT_JITTER
+	// Real-Time queue delay histogram: 0.1ms, then 1.025ms (last bin)
+	memset( (void *)aMidiRTJitter, 0, sizeof(aMidiRTJitter) );
+	TMR2H = (0x10000 - TIMER2_COUNTS + 100) >> 8;
+	TMR2L = (0x10000 - TIMER2_COUNTS + 100) & 0xFF;
+	put( 0, 0xF, 0xF8, 0x00, 0x00 );
+	TMR2H = (0x10000 - TIMER2_COUNTS + 500) >> 8;
+	TMR2L = (0x10000 - TIMER2_COUNTS + 500) & 0xFF;
+	send( 0, 0 );
+	put( 0, 0xF, 0xF8, 0x00, 0x00 );
+	later( 1 );
+	TMR2H = (0x10000 - TIMER2_COUNTS + 600) >> 8;
+	TMR2L = (0x10000 - TIMER2_COUNTS + 600) & 0xFF;
+	send( 0, 0 );
+	nWire = 0;
+	if( aMidiRTJitter[1] != 1 || aMidiRTJitter[MIDI_RT_BINS-1] != 1 )
+	{
+		printf("RT delay histogram: FAIL\n");
+		nErrors++;
+	}
+	else
+	{
+		printf("RT delay histogram: ok\n");
+	}
+#endif
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
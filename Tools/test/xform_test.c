@@ -0,0 +1,143 @@
+//---------------------------------------------------------------------------//
+// Transform stage test (MIDI_TRANSFORM 1): MIDI IN bytes go through the     //
+// raw ring and the parser into the event ring (aXformIn), host events go    //
+// through MIDI_Output to the wire (aXformOut). Checks channel remap and     //
+// drop, type filter, transpose with its range check, the velocity curve,    //
+// that Real-Time and SysEx pass, and the count of filtered IN events.       //
+//---------------------------------------------------------------------------//
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "firmware.h"
+
+#if !MIDI_TRANSFORM
+#error "build with -DMIDI_TRANSFORM=1"
+#endif
+
+static unsigned nErrors;
+
+// Compares n bytes with the list (ends with -1)
+static void expect(const char *name, const uint8_t *got, unsigned n, ...)
+{
+	uint8_t  want[64];
+	unsigned k = 0, i;
+	int      b;
+	va_list  ap;
+
+	va_start( ap, n );
+	while( (b = va_arg( ap, int )) >= 0 )
+		want[k++] = (uint8_t)b;
+	va_end( ap );
+
+	if( k != n || memcmp( want, got, n ) )
+	{
+		printf("%s: FAIL\n  want", name);
+		for(i = 0; i < k; i++)
+			printf(" %02X", want[i]);
+		printf("\n  got ");
+		for(i = 0; i < n; i++)
+			printf(" %02X", got[i]);
+		printf("\n");
+		nErrors++;
+	}
+	else
+	{
+		printf("%s: ok\n", name);
+	}
+}
+
+// MIDI IN bytes on port 0, parsed; returns the events put into the ring
+static unsigned receive(uint8_t *ev, const uint8_t *bytes, unsigned n)
+{
+	unsigned k = 0;
+
+	while( n-- )
+		UART_PutRaw( 0, *bytes++ );
+	MIDI2USB_Poll();
+	while( nMidiTail != nMidiHead )
+	{
+		memcpy( &ev[k], (const void *)aMidiRing[nMidiTail & MIDI_RING_MASK],
+		        MIDI_EVENT_SIZE );
+		k += MIDI_EVENT_SIZE;
+		nMidiTail++;
+	}
+	return k;
+}
+
+// Host event for MIDI OUT port 0; returns the bytes put on the wire
+static unsigned output(uint8_t *wire, uint8_t cin, uint8_t b1, uint8_t b2,
+                       uint8_t b3)
+{
+	SI_SEG_XDATA uint8_t ev[4];
+	unsigned k = 0;
+
+	ev[0] = cin;
+	ev[1] = b1;
+	ev[2] = b2;
+	ev[3] = b3;
+	if( !MIDI_Output( 0, MIDI_SRC_USB, ev ) )
+	{
+		printf("  event %X %02X %02X %02X refused\n", cin, b1, b2, b3);
+		nErrors++;
+	}
+	while( UART_NextByte( 0 ) )
+		wire[k++] = txByte;
+	return k;
+}
+
+int main(void)
+{
+	static const uint8_t in[] =
+	{
+		0x92, 0x3C, 0x40, 0x3D, 0x41,       // Running status
+		0x3E, 0x00,                         // Note On, velocity 0
+		0x91, 0x3C, 0x40,                   // Channel 2: dropped
+		0xA2, 0x3C, 0x10,                   // Poly Pressure: filtered
+		0x92, 0x74, 0x40,                   // Note 116+12: out of range
+		0xF8,                               // Clock: never filtered
+		0xB2, 0x07, 0x7F,                   // Control Change: no transpose
+		0xF0, 0x01, 0x02, 0xF7              // SysEx passes
+	};
+	uint8_t  buf[64];
+	unsigned n;
+
+	firmware_init();
+
+	// MIDI IN port 0: channel 2 dropped, 3 -> 6, +1 octave, velocity 100
+	aXformIn[0].chanMap[1] = MIDI_XF_DROP;
+	aXformIn[0].chanMap[2] = 5;
+	aXformIn[0].transpose  = 12;
+	aXformIn[0].velCurve   = MIDI_VEL_FIXED;
+	aXformIn[0].typeMask  &= ~MIDI_XF_POLY;
+	n = receive( buf, in, sizeof(in) );
+	expect( "IN events", buf, n,
+	        0x09, 0x95, 0x48, 0x64,  0x09, 0x95, 0x49, 0x64,
+	        0x09, 0x95, 0x4A, 0x00,  0x0B, 0xB5, 0x07, 0x7F,
+	        0x04, 0xF0, 0x01, 0x02,  0x05, 0xF7, 0x00, 0x00, -1 );
+	expect( "IN Real-Time", (const uint8_t *)aMidiRTQueue[0],
+	        (uint8_t)(nMidiRTHead - nMidiRTTail) * 2, 0x0F, 0xF8, -1 );
+	if( nMidiInFiltered != 3 || nMidiRingLost != 0 )
+	{
+		printf("IN filtered %u, lost %u: FAIL\n", nMidiInFiltered,
+		       nMidiRingLost);
+		nErrors++;
+	}
+
+	// MIDI OUT port 0: channel 1 -> 4, -1 octave, no Control Change
+	aXformOut[0].chanMap[0] = 3;
+	aXformOut[0].transpose  = -12;
+	aXformOut[0].typeMask  &= ~MIDI_XF_CC;
+	n  = output( buf,     0x9, 0x90, 0x48, 0x64 );
+	n += output( buf + n, 0xB, 0xB0, 0x07, 0x7F );   // Filtered
+	n += output( buf + n, 0x8, 0x80, 0x48, 0x00 );
+	n += output( buf + n, 0x9, 0x90, 0x05, 0x64 );   // Below note 0
+	n += output( buf + n, 0xF, 0xF8, 0x00, 0x00 );
+	n += output( buf + n, 0x4, 0xF0, 0x01, 0x02 );
+	n += output( buf + n, 0x5, 0xF7, 0x00, 0x00 );
+	expect( "OUT wire", buf, n, 0x93, 0x3C, 0x64, 0x83, 0x3C, 0x00, 0xF8,
+	        0xF0, 0x01, 0x02, 0xF7, -1 );
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Reads the MIDI2USB trace ring over EP0 and prints it as a timeline.
+
+The firmware must be built with MIDI_TRACE 1 (globals.h) and
+SLAB_USB_SETUP_CMD_CB 1 (usbconfig.h). Needs pyusb; on Linux give the
+user access to 1209:7522 with a udev rule, or run as root.
+
+    trace.py                 read the device, print the timeline
+    trace.py -o dump.bin     also save the raw dump
+    trace.py -i dump.bin     print a saved dump, no device needed
+"""
+
+import argparse
+import struct
+import sys
+
+VID, PID = 0x1209, 0x7522
+
+REQ_HEAD = 0x01                 # MIDI_TR_REQ_HEAD
+REQ_READ = 0x02                 # MIDI_TR_REQ_READ
+PAGE = 16                       # MIDI_TRACE_PAGE, records per read
+TMR2_RELOAD = 0x10000 - 4000    # Timer2 reload, 4000 counts (0.25us) per ms
+
+CODES = {                       # MIDI_TR_xxx, low nibble is port/cable
+    0x10: ("RX", "port"),
+    0x20: ("TX", "port"),
+    0x30: ("EVENT", "port"),
+    0x40: ("LOST", "port"),
+    0x50: ("WRITE", None),
+    0x60: ("IN_DONE", None),
+    0x70: ("OUT", None),
+}
+
+
+def read_device():
+    """Returns (head before, head after, size, ring bytes)."""
+    import usb.core
+
+    dev = usb.core.find(idVendor=VID, idProduct=PID)
+    if dev is None:
+        sys.exit("MIDI2USB not found (%04x:%04x)" % (VID, PID))
+
+    def head():
+        h, size = struct.unpack("<HH", bytes(dev.ctrl_transfer(0xC0, REQ_HEAD, 0, 0, 4)))
+        return h, size
+
+    head0, size = head()
+    ring = bytearray()
+    for page in range(size // PAGE):
+        ring += bytes(dev.ctrl_transfer(0xC0, REQ_READ, page, 0, PAGE * 4))
+    head1, _ = head()
+    return head0, head1, size, bytes(ring)
+
+
+def records(head0, head1, size, ring):
+    """Yields (index, code, arg, ms8, tmr2h) of the records still intact.
+
+    Records written while the ring was read (head0..head1) may have
+    replaced the oldest ones, those are dropped. The new ones are not
+    shown, the page holding them may have been read before them.
+    """
+    first = max(0, head1 - size)
+    for i in range(first, head0):
+        slot = (i % size) * 4
+        code, arg, ms8, hi = ring[slot:slot + 4]
+        yield i, code, arg, ms8, hi
+
+
+def timeline(recs):
+    """Prints records with time in ms from the first one."""
+    ms = None
+    last8 = 0
+    for i, code, arg, ms8, hi in recs:
+        if ms is None:
+            ms = 0
+        else:
+            ms += (ms8 - last8) & 0xFF          # 8-bit ms, unwrapped
+        last8 = ms8
+        counts = min(max((hi << 8) + 0x80 - TMR2_RELOAD, 0), 3999)
+        t = ms + counts / 4000.0                # TMR2H: 64us resolution
+
+        name, unit = CODES.get(code & 0xF0, ("?%02X" % code, None))
+        if unit:
+            where = "%s %d" % (unit, code & 0x0F)
+            data = "%02X" % arg
+        else:
+            where = ""
+            data = "%d bytes" % arg
+        print("%6d %10.3f ms  %-8s %-7s %s" % (i, t, name, where, data))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("-o", metavar="FILE", help="save the raw dump")
+    ap.add_argument("-i", metavar="FILE", help="decode a saved dump")
+    args = ap.parse_args()
+
+    if args.i:
+        with open(args.i, "rb") as f:
+            blob = f.read()
+        head0, head1, size = struct.unpack("<HHH", blob[:6])
+        ring = blob[6:]
+    else:
+        head0, head1, size, ring = read_device()
+        if args.o:
+            with open(args.o, "wb") as f:
+                f.write(struct.pack("<HHH", head0, head1, size) + ring)
+
+    # The head is 16-bit: unwrap head1 against head0
+    head1 = head0 + ((head1 - head0) & 0xFFFF)
+    timeline(records(head0, head1, size, ring))
+
+
+if __name__ == "__main__":
+    main()